@@ -0,0 +1,560 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <thread>
+#include <cstdlib>
+
+#include "test.hpp"
+#include "midi.hpp"
+#include "miditransport.hpp"
+#include "pagecache.hpp"
+#include "execute.hpp"
+#include "emulator.hpp"
+
+/**
+ * Run a function repeatedly and return the average time per run.
+ *
+ * @param f The function to time.
+ * @param iterations Number of runs.
+ * @return Average duration of one run in microseconds.
+ */
+template <typename F>
+double benchmarkRun(F f, unsigned iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i)
+    {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro> (end - start).count() / iterations;
+}
+
+/** Print one benchmark result line. */
+void benchmarkReport(std::string name, double usPerRun, std::string unit = "run")
+{
+    std::cout << "  " << std::left << std::setw(48) << name << std::right << std::setw(12) << std::fixed << std::setprecision(3) << usPerRun << " us/" << unit << std::endl;
+}
+
+/** Decode all patch fields once, like Patch::writeFileData does. */
+unsigned benchmarkDecodePatch(BitDecoder & bd)
+{
+    unsigned sum = 0;
+    for (auto it = g_fields.begin(); it != g_fields.end(); ++it)
+    {
+        if (it->type() == Field::Patch)
+        {
+            for (size_t i = 0; i < it->numFields(); ++i)
+            {
+                sum += bd.getValue(it->bitOffset(i), it->bitLength());
+            }
+        }
+    }
+    return sum;
+}
+
+void benchmarkBitDecoder()
+{
+    std::cout << "BitDecoder::getValue" << std::endl;
+
+    auto data = testData (250);
+    BitDecoder bd (data);
+    BitwiseDecoder ref (data);
+    volatile unsigned sink = 0;
+
+    // 9-bit field straddling a byte boundary (the fourth ID_PATCH_CTL_ field, bits 116 to 124)
+    benchmarkReport ("single 9-bit field, bitwise reference", benchmarkRun ([&] { sink = sink + ref.getValue(116, 9); }, 20000), "call");
+    benchmarkReport ("single 9-bit field, packed", benchmarkRun ([&] { sink = sink + bd.getValue(116, 9); }, 2000000), "call");
+    benchmarkReport ("all patch fields, bitwise reference", benchmarkRun ([&] { sink = sink + benchmarkDecodePatch(ref); }, 50), "patch");
+    benchmarkReport ("all patch fields, packed", benchmarkRun ([&] { sink = sink + benchmarkDecodePatch(bd); }, 5000), "patch");
+}
+
+/** Write all patch fields once, like loading a complete patch file does. */
+void benchmarkEncodePatch(BitCodec & bc)
+{
+    for (auto it = g_fields.begin(); it != g_fields.end(); ++it)
+    {
+        if (it->type() == Field::Patch)
+        {
+            for (size_t i = 0; i < it->numFields(); ++i)
+            {
+                bc.setValue(it->bitOffset(i), it->bitLength(), i);
+            }
+        }
+    }
+}
+
+void benchmarkBitCodec()
+{
+    std::cout << "BitCodec::setValue" << std::endl;
+
+    auto data = testData (250);
+    auto refData = data;
+    BitCodec bc (data);
+    BitwiseCodec ref (refData);
+
+    benchmarkReport ("single 9-bit field, bitwise reference", benchmarkRun ([&] { ref.setValue(116, 9, 0x155); }, 20000), "call");
+    benchmarkReport ("single 9-bit field, in place", benchmarkRun ([&] { bc.setValue(116, 9, 0x155); }, 2000000), "call");
+    benchmarkReport ("all patch fields, bitwise reference", benchmarkRun ([&] { benchmarkEncodePatch(ref); }, 20), "patch");
+    benchmarkReport ("all patch fields, in place", benchmarkRun ([&] { benchmarkEncodePatch(bc); }, 5000), "patch");
+
+    Patch ptch;
+    ptch.setData (data);
+    benchmarkReport ("Patch::setName", benchmarkRun ([&] { ptch.setName("Benchmark name"); }, 2000), "call");
+
+    std::string fn = "benchmark_patch.es8";
+    ptch.save (fn);
+    benchmarkReport ("Patch::load (complete patch file)", benchmarkRun ([&] { ptch.load(fn); }, 200), "file");
+    std::remove (fn.c_str());
+}
+
+void benchmarkDecodedData()
+{
+    std::cout << "DecodedData" << std::endl;
+
+    auto data = testData (250);
+    BitDecoder bd (data);
+    DecodedData dec (Field::Patch);
+    volatile unsigned sink = 0;
+
+    benchmarkReport ("all patch fields, per field lookup", benchmarkRun ([&] { sink = sink + benchmarkDecodePatch(bd); }, 5000), "patch");
+    benchmarkReport ("all patch fields, single sweep", benchmarkRun ([&] { dec.decode(data); }, 50000), "patch");
+    benchmarkReport ("all patch fields, encode", benchmarkRun ([&] { dec.encode(data); }, 50000), "patch");
+}
+
+void benchmarkFieldRegistry()
+{
+    std::cout << "Field registry" << std::endl;
+
+    std::string name = "ID_PATCH_MIDI_TX_CH_";
+    volatile size_t sink = 0;
+
+    benchmarkReport ("lookup by name", benchmarkRun ([&] { sink = sink + g_fields.at(name).bitLength(); }, 1000000), "call");
+    benchmarkReport ("lookup by FieldId", benchmarkRun ([&] { sink = sink + g_fields.at(FieldId::ID_PATCH_MIDI_TX_CH_).bitLength(); }, 1000000), "call");
+}
+
+/** Patch with access to the in-memory parser and formatter. */
+class BenchmarkPatch : public Patch
+{
+    public:
+        using ES8Data::loadValues;
+        using Patch::writeFileData;
+};
+
+void benchmarkLoadLibrary()
+{
+    std::cout << "Patch library export and loading" << std::endl;
+
+    const unsigned numPatches = 800;
+    std::string dir = "benchmark_library";
+    mkdir (dir.c_str(), 0755);
+
+    std::vector<Patch> patches (numPatches);
+    std::vector<std::string> files;
+    for (unsigned i = 0; i < numPatches; ++i)
+    {
+        auto data = testData (250, i);
+        patches[i].setData (data);
+        patches[i].setName ("Benchmark " + std::to_string (i + 1));
+        files.push_back (dir + "/" + std::to_string (i + 1) + ".es8");
+    }
+
+    double us = benchmarkRun ([&] { for (unsigned i = 0; i < numPatches; ++i) patches[i].save (files[i]); }, 3);
+    benchmarkReport ("export 800 patch files", us, "library");
+    benchmarkReport ("export one patch file", us / numPatches, "file");
+
+    BenchmarkPatch bptch;
+    auto data = testData (250, 1);
+    bptch.setData (data);
+    std::string text;
+    us = benchmarkRun ([&] { text.clear(); bptch.writeFileData (text); }, 2000);
+    benchmarkReport ("format one patch file in memory", us, "file");
+    benchmarkReport ("format throughput (" + std::to_string (text.size()) + " bytes/file)", us * 1000000.0 / text.size(), "MB");
+
+    Patch ptch;
+    us = benchmarkRun ([&] { for (auto & fn : files) ptch.load (fn); }, 3);
+    benchmarkReport ("load 800 patch files", us, "library");
+    benchmarkReport ("load one patch file", us / numPatches, "file");
+
+    auto buffer = loadFile (files[0]);
+    benchmarkReport ("parse one patch file from memory", benchmarkRun ([&] { bptch.loadValues (buffer, "ES8cli patch file format 1", "Wrong patch file format"); }, 2000), "file");
+
+    for (auto & fn : files)
+    {
+        std::remove (fn.c_str());
+    }
+    rmdir (dir.c_str());
+}
+
+/**
+ * Round trip of one page through two queues and an echo thread, waiting
+ * for each message either with the condition variable or by sleep-polling
+ * like the old receive loop did.
+ */
+double benchmarkRoundTrip(bool poll, unsigned iterations)
+{
+    using namespace std::chrono_literals;
+    SysExQueue request, reply;
+    std::vector<uint8_t> page (155, 0x10);
+
+    auto receive = [poll] (SysExQueue & queue, std::vector<uint8_t> & message) {
+        if (!poll)
+        {
+            return queue.pop (message, SysExQueue::Clock::now() + 1000ms);
+        }
+        for (unsigned timeout = 1000; timeout > 0; --timeout)
+        {
+            if (queue.tryPop (message))
+            {
+                return true;
+            }
+            std::this_thread::sleep_for (1ms);
+        }
+        return false;
+    };
+
+    std::thread echo ([&] {
+        std::vector<uint8_t> message;
+        for (unsigned i = 0; i < iterations && receive (request, message); ++i)
+        {
+            reply.push (message.data(), message.size());
+        }
+    });
+
+    std::vector<uint8_t> message;
+    double us = benchmarkRun ([&] { request.push (page.data(), page.size()); receive (reply, message); }, iterations);
+    echo.join();
+    return us;
+}
+
+void benchmarkSysExQueue()
+{
+    std::cout << "MIDI receive path" << std::endl;
+    benchmarkReport ("page round trip, sleep-poll 1 ms", benchmarkRoundTrip (true, 200), "page");
+    benchmarkReport ("page round trip, wait/notify", benchmarkRoundTrip (false, 20000), "page");
+}
+
+/**
+ * Frame a raw byte stream of DT1 pages into the receive queue, either in
+ * place with SysExFramer like AlsaRawMidiTransport, or through a new
+ * vector per message like the RtMidi input thread. Then decode the pages.
+ */
+void benchmarkFraming()
+{
+    Emulator device (1);
+    std::vector<uint8_t> stream;
+    std::vector<std::vector<uint8_t>> replies;
+    for (unsigned patch = 0; patch < Emulator::numPatches; ++patch)
+    {
+        replies.clear();
+        std::vector<uint8_t> request = RequestDataMessage (14 + 2 * patch, 2).getMessageData();
+        device.respond (request, replies);
+        for (auto & reply : replies)
+        {
+            stream.insert (stream.end(), reply.begin(), reply.end());
+            stream.push_back (0xf8);
+        }
+    }
+    const unsigned pages = 2 * Emulator::numPatches;
+
+    SysExQueue queue;
+    std::vector<uint8_t> message;
+
+    SysExFramer framer;
+    double us = benchmarkRun ([&] {
+        for (size_t off = 0; off < stream.size(); off += 4096)
+        {
+            framer.feed (&stream[off], std::min<size_t> (4096, stream.size() - off), [&] (const uint8_t * data, size_t size) {
+                queue.push (data, size);
+                queue.tryPop (message);
+            });
+        }
+    }, 20);
+    benchmarkReport ("frame 1600 pages in place", us / pages, "page");
+
+    us = benchmarkRun ([&] {
+        std::vector<uint8_t> * current = nullptr;
+        for (uint8_t b : stream)
+        {
+            if (b >= 0xf8)
+            {
+                continue;
+            }
+            if (b == 0xf0)
+            {
+                delete current;
+                current = new std::vector<uint8_t>;
+            }
+            if (current)
+            {
+                current->push_back (b);
+                if (b == 0xf7)
+                {
+                    queue.push (current->data(), current->size());
+                    queue.tryPop (message);
+                    delete current;
+                    current = nullptr;
+                }
+            }
+        }
+        delete current;
+    }, 20);
+    benchmarkReport ("frame 1600 pages, one vector per message", us / pages, "page");
+
+    // Checking and decoding pages: framing first and then a second pass per
+    // page, or everything in one pass while the bytes stream in.
+    std::vector<uint8_t> decoded;
+    decoded.reserve (pages * PageFramer::dataSize);
+    us = benchmarkRun ([&] {
+        decoded.clear();
+        framer.feed (stream.data(), stream.size(), [&] (const uint8_t * data, size_t size) {
+            if (size == PageFramer::pageSize)
+            {
+                MIDI::unscramblePage (data, decoded);
+            }
+        });
+    }, 20);
+    benchmarkReport ("decode 1600 pages, frame then unscramble", us / pages, "page");
+
+    PageFramer pageFramer;
+    pageFramer.route (0, 1 << 14, [&] (unsigned, const uint8_t * data, bool) { decoded.insert (decoded.end(), data, data + PageFramer::dataSize); });
+    us = benchmarkRun ([&] {
+        decoded.clear();
+        for (size_t off = 0; off < stream.size(); off += 4096)
+        {
+            pageFramer.feed (&stream[off], std::min<size_t> (4096, stream.size() - off));
+        }
+    }, 20);
+    benchmarkReport ("decode 1600 pages, streaming", us / pages, "page");
+}
+
+void benchmarkTransfer(const std::string & link, std::chrono::microseconds latency, unsigned bytesPerSecond, unsigned patches)
+{
+    Emulator device (1);
+    MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (device.responder(), latency, bytesPerSecond)));
+    midi.identity();
+
+    std::vector<uint8_t> data;
+    double us = benchmarkRun ([&] { midi.retrievePatches (0, 1, [&] (unsigned, const std::vector<uint8_t> & d) { data = d; }); }, 20);
+    benchmarkReport (link + ", read one patch", us, "patch");
+
+    us = benchmarkRun ([&] { midi.retrievePatches (0, patches, [&] (unsigned, const std::vector<uint8_t> & d) { data = d; }); }, 1);
+    benchmarkReport (link + ", read " + std::to_string (patches) + " patches", us / patches, "patch");
+
+    us = benchmarkRun ([&] { midi.clearKnownPatches(); midi.sendPatches (0, patches, [&] (unsigned) { return data; }); }, 1);
+    benchmarkReport (link + ", write " + std::to_string (patches) + " patches", us / patches, "patch");
+}
+
+/** Rename a range of patches read before, sending all pages or only the changed ones. */
+void benchmarkDeltaWrites(const std::string & link, std::chrono::microseconds latency, unsigned bytesPerSecond, unsigned patches)
+{
+    Emulator device (1);
+    MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (device.responder(), latency, bytesPerSecond)));
+
+    std::vector<std::vector<uint8_t>> renamed;
+    midi.retrievePatches (0, patches, [&] (unsigned, const std::vector<uint8_t> & d) {
+        std::vector<uint8_t> data (d);
+        Patch ptch;
+        ptch.setData (data);
+        ptch.setName ("Renamed");
+        renamed.push_back (ptch.data());
+    });
+    auto source = [&] (unsigned patch) { return renamed[patch]; };
+
+    // The device still holds the patches read above
+    unsigned sent = midi.writeStats().pages;
+    double delta = benchmarkRun ([&] { midi.sendPatches (0, patches, source); }, 1);
+    benchmarkReport (link + ", rename " + std::to_string (patches) + " patches, changed pages", delta / patches, "patch");
+    std::cout << "  " << midi.writeStats().pages - sent << " of " << 2 * patches << " pages sent" << std::endl;
+
+    double full = benchmarkRun ([&] { midi.clearKnownPatches(); midi.sendPatches (0, patches, source); }, 1);
+    benchmarkReport (link + ", rename " + std::to_string (patches) + " patches, all pages", full / patches, "patch");
+}
+
+/** Runs that each view one patch, without and with a cache file from an earlier run. */
+void benchmarkCachedView(const std::string & link, std::chrono::microseconds latency, unsigned bytesPerSecond)
+{
+    const std::string filename = "benchmark.cache";
+    std::remove (filename.c_str());
+    Emulator device (1);
+    auto view = [&] (bool cached) {
+        PageCache cache (filename);
+        MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (device.responder(), latency, bytesPerSecond)));
+        if (cached)
+        {
+            midi.setCache (&cache);
+        }
+        midi.retrievePatch (44);
+        cache.save();
+    };
+
+    double uncached = benchmarkRun ([&] { view (false); }, 5);
+    view (true);
+    double cached = benchmarkRun ([&] { view (true); }, 5);
+    std::remove (filename.c_str());
+
+    benchmarkReport (link + ", view a patch", uncached, "run");
+    benchmarkReport (link + ", view a patch from the cache", cached, "run");
+}
+
+/** The first bank of example.sh as one program, planned or command by command. */
+void benchmarkProgram(const std::string & link, std::chrono::microseconds latency, unsigned bytesPerSecond)
+{
+    std::vector<std::string> args {"es8cli"};
+    const char * names[] = {"Clean", "Fuzz", "Drive", "Crunch", "HiGain", "Clean Flange", "Clean Chorus", "HiGain Flange"};
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        for (std::string arg : {"select", "799", "name", names[i], "store"})
+        {
+            args.push_back (arg);
+        }
+        args.push_back (std::to_string (i + 1));
+        args.push_back ("display");
+    }
+    std::vector<char *> argv;
+    for (auto & arg : args)
+    {
+        argv.push_back (&arg[0]);
+    }
+    CmdLineParameters config;
+    parseCommandLine (config, int (argv.size()), argv.data());
+
+    Emulator device (1);
+    std::streambuf * out = std::cout.rdbuf (nullptr);
+    double planned = benchmarkRun ([&] {
+        MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (device.responder(), latency, bytesPerSecond)));
+        runCommands (config.commands, &midi);
+    }, 1);
+    double oneByOne = benchmarkRun ([&] {
+        MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (device.responder(), latency, bytesPerSecond)));
+        std::vector<uint8_t> data;
+        for (auto & cmd : config.commands)
+        {
+            executeCommand (cmd, data, &midi);
+        }
+        midi.confirmWrites();
+    }, 1);
+    std::cout.rdbuf (out);
+    std::cout.clear();
+
+    benchmarkReport (link + ", 8 patches from a template, planned", planned, "program");
+    benchmarkReport (link + ", 8 patches from a template, one by one", oneByOne, "program");
+}
+
+/** Read all patches over a link that loses or corrupts some pages. */
+void benchmarkFaultyRead()
+{
+    using namespace std::chrono_literals;
+    Emulator device (1);
+    Emulator::Faults faults;
+    faults.dropRead = 0.005;
+    faults.corruptRead = 0.005;
+    device.setFaults (faults);
+    MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (device.responder(), 1000us)));
+    midi.setReadTimeout (20ms);
+    midi.identity();
+
+    double us = benchmarkRun ([&] { midi.retrievePatches (0, Emulator::numPatches, [] (unsigned, const std::vector<uint8_t> &) {}); }, 1);
+    benchmarkReport ("USB, read 800 patches, 1% of pages lost or corrupt", us / Emulator::numPatches, "patch");
+    std::cout << "  " << midi.readStats().retriedPages << " of " << midi.readStats().pages << " pages requested again in "
+              << midi.readStats().retries << " retries" << std::endl;
+}
+
+/** Read scattered patches like "view 3 view 417 view 799", one after the other or prefetched. */
+void benchmarkScatteredReads(const std::string & link, std::chrono::microseconds latency, unsigned bytesPerSecond)
+{
+    const std::vector<unsigned> patches {3, 417, 799, 42, 600, 128, 7, 365};
+    Emulator device (1);
+    MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (device.responder(), latency, bytesPerSecond)));
+    midi.identity();
+
+    double sequential = benchmarkRun ([&] { for (auto p : patches) midi.retrievePatch (p); }, 5);
+    double prefetched = benchmarkRun ([&] { midi.prefetchPatches (patches); for (auto p : patches) midi.retrievePatch (p); }, 5);
+
+    benchmarkReport (link + ", 8 scattered reads, one at a time", sequential / patches.size(), "patch");
+    benchmarkReport (link + ", 8 scattered reads, prefetched", prefetched / patches.size(), "patch");
+}
+
+void benchmarkTransport()
+{
+    using namespace std::chrono_literals;
+    std::cout << "MIDI transfers over the loopback transport" << std::endl;
+
+    benchmarkFraming();
+    benchmarkTransfer ("USB (1 ms latency)", 1000us, 0, 800);
+    benchmarkTransfer ("DIN (31250 baud)", 1000us, 3125, 16);
+    benchmarkDeltaWrites ("DIN (31250 baud)", 1000us, 3125, 16);
+    benchmarkFaultyRead ();
+    benchmarkScatteredReads ("USB (1 ms latency)", 1000us, 0);
+    benchmarkScatteredReads ("DIN (31250 baud)", 1000us, 3125);
+    benchmarkCachedView ("USB (1 ms latency)", 1000us, 0);
+    benchmarkCachedView ("DIN (31250 baud)", 1000us, 3125);
+    benchmarkProgram ("USB (1 ms latency)", 1000us, 0);
+    benchmarkProgram ("DIN (31250 baud)", 1000us, 3125);
+
+    // Record a session against the loopback device, then replay it with the recorded timing
+    std::string session = "benchmark_session.txt";
+    {
+        Emulator device (1);
+        std::unique_ptr<MidiTransport> loopback (new LoopbackTransport (device.responder(), 1000us));
+        MIDI midi (std::unique_ptr<MidiTransport> (new RecordingTransport (std::move (loopback), session)));
+        midi.retrievePatches (0, 64, [] (unsigned, const std::vector<uint8_t> &) {});
+    }
+    double us = benchmarkRun ([&] {
+        MIDI midi (std::unique_ptr<MidiTransport> (new ReplayTransport (session)));
+        midi.retrievePatches (0, 64, [] (unsigned, const std::vector<uint8_t> &) {});
+    }, 3);
+    benchmarkReport ("replay: read 64 patches", us / 64, "patch");
+    std::remove (session.c_str());
+
+    // A real device on ALSA: ES8CLI_RAWMIDI names the raw MIDI device (e.g.
+    // hw:1,0,0), ES8CLI_MIDI_PORT the RtMidi port index of the same device.
+    const char * rawDevice = std::getenv ("ES8CLI_RAWMIDI");
+    const char * port = std::getenv ("ES8CLI_MIDI_PORT");
+#if defined(__LINUX_ALSA__)
+    if (rawDevice)
+    {
+        MIDI midi (std::unique_ptr<MidiTransport> (new AlsaRawMidiTransport (rawDevice)));
+        us = benchmarkRun ([&] { midi.retrievePatches (0, 64, [] (unsigned, const std::vector<uint8_t> &) {}); }, 1);
+        benchmarkReport ("ALSA raw MIDI: read 64 patches", us / 64, "patch");
+    }
+    if (port)
+    {
+        unsigned index = std::atoi (port);
+        MIDI midi (std::unique_ptr<MidiTransport> (new RtMidiTransport (index, index)));
+        us = benchmarkRun ([&] { midi.retrievePatches (0, 64, [] (unsigned, const std::vector<uint8_t> &) {}); }, 1);
+        benchmarkReport ("RtMidi ALSA sequencer: read 64 patches", us / 64, "patch");
+    }
+#endif
+    if (!rawDevice && !port)
+    {
+        std::cout << "  device benchmarks skipped, set ES8CLI_RAWMIDI and ES8CLI_MIDI_PORT" << std::endl;
+    }
+#if !defined(__LINUX_ALSA__)
+    else
+    {
+        std::cout << "  device benchmarks skipped, built without ALSA" << std::endl;
+    }
+#endif
+}
+
+void runBenchmarks()
+{
+    benchmarkBitDecoder();
+    benchmarkBitCodec();
+    benchmarkDecodedData();
+    benchmarkFieldRegistry();
+    benchmarkLoadLibrary();
+    benchmarkSysExQueue();
+    benchmarkTransport();
+}
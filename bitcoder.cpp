@@ -6,6 +6,7 @@
 #include "bitcoder.hpp"
 
 #include <iostream>
+#include <stdexcept>
 
 
 BitDecoder::BitDecoder (const std::vector<uint8_t> & data) : m_data(data)
@@ -14,13 +15,16 @@ BitDecoder::BitDecoder (const std::vector<uint8_t> & data) : m_data(data)
 
 unsigned BitDecoder::getValue(size_t off, size_t len)
 {
-    auto bitData = bitifyData (m_data);
-    unsigned result = 0;
-    for (size_t i = 0; i < len; ++i)
+    if (len == 0)
     {
-	result += bitData[off+i] << (len-1-i);
+        return 0;
     }
-    return result;
+    if (len > 8 * sizeof(unsigned) || off + len > m_data.size() * 8)
+    {
+        throw std::out_of_range ("Bit field out of range");
+    }
+
+    return extractBits (m_data.data(), off, len);
 }
 
 BitCodec::BitCodec (std::vector<uint8_t> & data) : BitDecoder(data), m_encData(data)
@@ -29,12 +33,16 @@ BitCodec::BitCodec (std::vector<uint8_t> & data) : BitDecoder(data), m_encData(d
 
 void BitCodec::setValue(size_t off, size_t len, unsigned bits)
 {
-    auto bitData = bitifyData (m_encData);
-    for (size_t i = 0; i < len; ++i)
+    if (len == 0)
     {
-	bitData[off+i] = (bits >> (len-1-i)) & 1;
+        return;
     }
-    m_encData = unBitifyData(bitData);
+    if (len > 8 * sizeof(unsigned) || off + len > m_encData.size() * 8)
+    {
+        throw std::out_of_range ("Bit field out of range");
+    }
+
+    insertBits (m_encData.data(), off, len, bits);
 }
 
 std::vector<uint8_t> BitDecoder::bitifyData(const std::vector<uint8_t> & data)
@@ -4,6 +4,60 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Read a value from a packed, MSB-first bitstream without range checks.
+ *
+ * @param data Binary data blob.
+ * @param off Position of the value in bits.
+ * @param len Bit depth of the value (1 to 32).
+ * @return The value stored at the specified position.
+ */
+inline unsigned extractBits(const uint8_t * data, size_t off, size_t len)
+{
+    // Collect the bytes the field touches (MSB first), then shift out the
+    // trailing bits and mask off the leading ones. At most 5 bytes for 32 bits.
+    size_t first = off / 8;
+    size_t last = (off + len - 1) / 8;
+    uint64_t acc = 0;
+    for (size_t i = first; i <= last; ++i)
+    {
+        acc = (acc << 8) | data[i];
+    }
+    size_t trailing = (last + 1) * 8 - (off + len);
+    return unsigned ((acc >> trailing) & ((uint64_t (1) << len) - 1));
+}
+
+/**
+ * Store a value in a packed, MSB-first bitstream without range checks.
+ * Only the bytes covered by the value are modified.
+ *
+ * @param data Binary data blob.
+ * @param off Position of the value in bits.
+ * @param len Bit depth of the value (1 to 32).
+ * @param bits The value to store; excess high bits are ignored.
+ */
+inline void insertBits(uint8_t * data, size_t off, size_t len, unsigned bits)
+{
+    // Walk the touched bytes from the last one to the first, replacing only
+    // the bits that belong to the field.
+    size_t pos = off + len;
+    size_t remaining = len;
+    while (remaining > 0)
+    {
+        size_t byte = (pos - 1) / 8;
+        size_t used = pos - byte * 8;
+        size_t n = remaining < used ? remaining : used;
+        unsigned shift = 8 - used;
+        uint8_t mask = ((1u << n) - 1) << shift;
+        data[byte] = (data[byte] & ~mask) | ((bits << shift) & mask);
+        bits >>= n;
+        remaining -= n;
+        pos -= n;
+    }
+}
 
 /**
  * Handle values in a non-uniform bitstream.
@@ -22,6 +76,9 @@ class BitDecoder
         /**
          * Get a value from a specific position, with a specific bit depth.
          *
+         * Reads directly from the packed bytes; fields may straddle byte
+         * boundaries. Throws std::out_of_range if the field exceeds the data.
+         *
          * @param off Position of the value in bits.
          * @param len Bit depth of the value.
          * @return The value stored at the specified position.
@@ -62,8 +119,9 @@ class BitCodec : public BitDecoder
         /**
          * Set a value at a specific position, with a specific bit depth.
          *
-         * @param data Bit array, one bit per index.
-
+         * Only the bytes covered by the field are modified, in place.
+         * Throws std::out_of_range if the field exceeds the data.
+         *
          * @param off Position of the value in bits.
          * @param len Bit depth of the value.
          * @param bits The value to be stored at the specified position.
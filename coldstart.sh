@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Measure the process start-up cost of es8cli against a no-op C++ program.
+#
+# usage: ./coldstart.sh [path to es8cli] [runs]
+
+ES8CLI=${1:-./es8cli}
+RUNS=${2:-500}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+echo 'int main() { return 0; }' > "$TMP/noop.cpp"
+${CXX:-c++} -O2 -o "$TMP/noop" "$TMP/noop.cpp" || exit 1
+
+measure()
+{
+    local start end
+    start=$(date +%s%N)
+    for ((i = 0; i < RUNS; ++i))
+    do
+        "$@" > /dev/null
+    done
+    end=$(date +%s%N)
+    echo "$(( (end - start) / RUNS / 1000 )) us/run"
+}
+
+echo "no-op program:  $(measure "$TMP/noop")"
+echo "es8cli --help:  $(measure "$ES8CLI" --help)"
@@ -2,6 +2,9 @@
 /* The file LICENSE contains more information about licensing. */
 
 #include "commandline.hpp"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
 
 void parseCommandLine (CmdLineParameters & config, int argc, char *argv[])
 {
@@ -37,7 +40,69 @@ void parseCommandLine (CmdLineParameters & config, int argc, char *argv[])
         }
     }
 
-    if (config.midiin && config.midiout)
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--midi-baud"))) != clparameters.end())
+    {
+        auto prev = pos++;
+        if (pos != clparameters.end())
+        {
+            std::stringstream conv(*pos);
+            conv >> config.midibaud;
+            clparameters.erase(prev);
+            clparameters.erase(pos);
+        }
+    }
+
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--record"))) != clparameters.end())
+    {
+        auto prev = pos++;
+        if (pos != clparameters.end())
+        {
+            config.recordFile = *pos;
+            clparameters.erase(prev);
+            clparameters.erase(pos);
+        }
+    }
+
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--replay"))) != clparameters.end())
+    {
+        auto prev = pos++;
+        if (pos != clparameters.end())
+        {
+            config.replayFile = *pos;
+            clparameters.erase(prev);
+            clparameters.erase(pos);
+        }
+    }
+
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--rawmidi"))) != clparameters.end())
+    {
+        auto prev = pos++;
+        if (pos != clparameters.end())
+        {
+            config.rawMidiDevice = *pos;
+            clparameters.erase(prev);
+            clparameters.erase(pos);
+        }
+    }
+
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--cache"))) != clparameters.end())
+    {
+        auto prev = pos++;
+        if (pos != clparameters.end())
+        {
+            config.cacheFile = *pos;
+            clparameters.erase(prev);
+            clparameters.erase(pos);
+        }
+    }
+
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--refresh"))) != clparameters.end())
+    {
+        config.refresh = true;
+        clparameters.erase(pos);
+    }
+
+    if ((config.midiin && config.midiout) || !config.replayFile.empty() || !config.rawMidiDevice.empty())
     {
         config.hasMidi = true;
     }
@@ -76,6 +141,18 @@ void parseCommandLine (CmdLineParameters & config, int argc, char *argv[])
         clparameters.erase(pos);
     }
 
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--benchmark"))) != clparameters.end())
+    {
+        config.mode = CmdLineParameters::Benchmark;
+        clparameters.erase(pos);
+    }
+
+    if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--emulate"))) != clparameters.end())
+    {
+        config.mode = CmdLineParameters::Emulate;
+        clparameters.erase(pos);
+    }
+
     if ((pos = std::find (clparameters.begin(), clparameters.end(), std::string ("--help"))) != clparameters.end())
     {
         config.mode = CmdLineParameters::Help;
@@ -157,6 +234,21 @@ void parseCommandLine (CmdLineParameters & config, int argc, char *argv[])
                     curCommand = Command (CommandType::PatchMidiCC);
                     paramCount = 4;
                 }
+                else if (c == "backup") 
+                {
+                    curCommand = Command (CommandType::Backup);
+                    paramCount = 3;
+                }
+                else if (c == "restore") 
+                {
+                    curCommand = Command (CommandType::Restore);
+                    paramCount = 3;
+                }
+                else if (c == "list") 
+                {
+                    curCommand = Command (CommandType::List);
+                    paramCount = 2;
+                }
                 else 
                 {
                     throw std::runtime_error (std::string ("Unknown command: ") + c);
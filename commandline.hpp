@@ -10,9 +10,15 @@
 
 struct CmdLineParameters
 {
-    enum { Usage, Help, ListMidi, SelfTest, Run, None } mode = None;
+    enum { Usage, Help, ListMidi, SelfTest, Benchmark, Emulate, Run, None } mode = None;
     unsigned midiin=0;
     unsigned midiout=0;
+    unsigned midibaud=0;
+    std::string recordFile;
+    std::string replayFile;
+    std::string rawMidiDevice;
+    std::string cacheFile;
+    bool refresh = false;
     bool unscramble = false;
     bool verbose = false;
     bool rawFile = false;
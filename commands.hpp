@@ -6,11 +6,13 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <climits>
+#include <stdexcept>
 
 #include "helpers.h"
 
 ///@todo: Display vs. View -> better naming
-typedef enum { None, Select, Display, View, Copy, Store, Name, PatchMidiChannel, PatchMidiPC, PatchMidiCC, Input, Output, Loops } CommandType;
+typedef enum { None, Select, Display, View, Copy, Store, Name, PatchMidiChannel, PatchMidiPC, PatchMidiCC, Input, Output, Loops, Backup, Restore, List } CommandType;
 
 class Command
 {
@@ -0,0 +1,144 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#include "decodeddata.hpp"
+#include "bitcoder.hpp"
+
+DecodedData::DecodedData (Field::Type type) : m_layout (layout (type)), m_values (m_layout.slots.size())
+{
+}
+
+const DecodedData::Layout & DecodedData::layout (Field::Type type)
+{
+    static Layout layouts[2];
+    Layout & result = layouts[type];
+
+    if (result.fields.empty())
+    {
+        result.firstValue.resize (g_fields.size(), SIZE_MAX);
+        for (auto & field : g_fields)
+        {
+            if (field.type() == type)
+            {
+                result.fields.push_back (g_fields.idOf (field));
+                result.firstValue[size_t (g_fields.idOf (field))] = result.slots.size();
+                for (size_t i = 0; i < field.numFields(); ++i)
+                {
+                    result.slots.push_back ({field.bitOffset(i), field.bitLength(), result.slots.size()});
+                }
+            }
+        }
+
+        std::sort (result.slots.begin(), result.slots.end(), [] (const Slot & a, const Slot & b) { return a.bitOffset < b.bitOffset; });
+    }
+
+    return result;
+}
+
+void DecodedData::decode (const std::vector<uint8_t> & data)
+{
+    // Bits are consumed from the front of acc; only the lowest accBits are valid.
+    uint64_t acc = 0;
+    size_t accBits = 0;
+    size_t bitPos = 0;
+    size_t nextByte = 0;
+
+    for (auto & slot : m_layout.slots)
+    {
+        if (slot.bitOffset < bitPos || slot.bitOffset + slot.bitLength > data.size() * 8)
+        {
+            throw std::logic_error ("Overlapping or out of range field layout");
+        }
+
+        size_t gap = slot.bitOffset - bitPos;
+        if (gap <= accBits)
+        {
+            accBits -= gap;
+        }
+        else
+        {
+            gap -= accBits;
+            nextByte += gap / 8;
+            acc = data[nextByte++];
+            accBits = 8 - gap % 8;
+        }
+
+        while (accBits < slot.bitLength)
+        {
+            acc = (acc << 8) | data[nextByte++];
+            accBits += 8;
+        }
+
+        accBits -= slot.bitLength;
+        m_values[slot.valueIndex] = unsigned ((acc >> accBits) & ((uint64_t (1) << slot.bitLength) - 1));
+        bitPos = slot.bitOffset + slot.bitLength;
+    }
+}
+
+void DecodedData::encode (std::vector<uint8_t> & data) const
+{
+    BitCodec bc (data);
+    for (auto & slot : m_layout.slots)
+    {
+        bc.setValue (slot.bitOffset, slot.bitLength, m_values[slot.valueIndex]);
+    }
+}
+
+size_t DecodedData::numFields () const
+{
+    return m_layout.fields.size();
+}
+
+const Field & DecodedData::field (size_t f) const
+{
+    return g_fields.at (m_layout.fields.at(f));
+}
+
+unsigned DecodedData::value (size_t f, size_t index) const
+{
+    return m_values[valueIndex (m_layout.fields.at(f), index)];
+}
+
+unsigned DecodedData::value (FieldId id, size_t index) const
+{
+    return m_values[valueIndex (id, index)];
+}
+
+unsigned DecodedData::value (const std::string & id, size_t index) const
+{
+    return value (g_fields.idOf (g_fields.at (id)), index);
+}
+
+void DecodedData::setValue (size_t f, size_t index, unsigned value)
+{
+    m_values[valueIndex (m_layout.fields.at(f), index)] = value;
+}
+
+void DecodedData::setValue (FieldId id, size_t index, unsigned value)
+{
+    m_values[valueIndex (id, index)] = value;
+}
+
+size_t DecodedData::valueIndex (FieldId id, size_t index) const
+{
+    size_t first = m_layout.firstValue.at (size_t (id));
+    if (first == SIZE_MAX || index >= g_fields.at(id).numFields())
+    {
+        throw std::out_of_range ("Field not available");
+    }
+    return first + index;
+}
+
+bool DecodedData::operator== (const DecodedData & other) const
+{
+    return &m_layout == &other.m_layout && m_values == other.m_values;
+}
+
+bool DecodedData::operator!= (const DecodedData & other) const
+{
+    return !(*this == other);
+}
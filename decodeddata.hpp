@@ -0,0 +1,90 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "es8parameters.hpp"
+
+/**
+ * All field values of a patch or of the globals, decoded in a single sweep.
+ *
+ * Values are kept in one flat array, indexed by field (in g_fields order)
+ * and subindex. Decoding walks the bitstream once in offset order.
+ */
+class DecodedData
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param type Which fields to decode (patch or globals).
+         */
+        DecodedData (Field::Type type);
+
+        /**
+         * Decode all fields from a binary data blob.
+         *
+         * @param data Binary data blob (a patch or the globals).
+         */
+        void decode (const std::vector<uint8_t> & data);
+
+        /**
+         * Write all fields back into a binary data blob, in offset order.
+         *
+         * @param data Binary data blob to update.
+         */
+        void encode (std::vector<uint8_t> & data) const;
+
+        /** Number of fields (not counting subindexes). */
+        size_t numFields () const;
+
+        /** Field description by field index. */
+        const Field & field (size_t f) const;
+
+        /** Value by field index and subindex. */
+        unsigned value (size_t f, size_t index = 0) const;
+
+        /** Value by field handle and subindex. */
+        unsigned value (FieldId id, size_t index = 0) const;
+
+        /** Value by field name and subindex. */
+        unsigned value (const std::string & id, size_t index = 0) const;
+
+        /** Set a value by field index and subindex. */
+        void setValue (size_t f, size_t index, unsigned value);
+
+        /** Set a value by field handle and subindex. */
+        void setValue (FieldId id, size_t index, unsigned value);
+
+        bool operator== (const DecodedData & other) const;
+        bool operator!= (const DecodedData & other) const;
+
+    private:
+        /** Location of one value in the bitstream. */
+        struct Slot
+        {
+            size_t bitOffset;
+            size_t bitLength;
+            size_t valueIndex;
+        };
+
+        /** Field layout of one type, shared by all instances. */
+        struct Layout
+        {
+            /** Fields of this type, in registry order. */
+            std::vector<FieldId> fields;
+            /** Index of the first value of a field, indexed by FieldId. */
+            std::vector<size_t> firstValue;
+            /** Value locations, sorted by bit offset. */
+            std::vector<Slot> slots;
+        };
+
+        static const Layout & layout (Field::Type type);
+        size_t valueIndex (FieldId id, size_t index) const;
+
+        const Layout & m_layout;
+        std::vector<unsigned> m_values;
+};
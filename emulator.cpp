@@ -0,0 +1,207 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+
+#include "rtmidi-4.0.0/RtMidi.h"
+#include "emulator.hpp"
+#include "midi.hpp"
+#include "midimessages.hpp"
+
+/** Build the DT1 messages for 125 byte blocks of unscrambled data. */
+static void makePages (const std::vector<uint8_t> & data, unsigned firstPage, std::vector<std::vector<uint8_t>>::iterator out)
+{
+    auto scrambled = MIDI::scrambleData (data);
+    for (size_t i = 0; i < scrambled.size() / 155; ++i)
+    {
+        WritePageMessage wpm (firstPage + i, std::vector<uint8_t> (&scrambled[i * 155], &scrambled[(i + 1) * 155]));
+        *out++ = wpm.getMessageData();
+    }
+}
+
+Emulator::Emulator (unsigned seed) : m_system (numSystemPages), m_patches (2 * numPatches), m_random (1), m_requests (0), m_writes (0)
+{
+    std::mt19937 random (seed);
+    std::uniform_int_distribution<unsigned> byte (0, 255);
+    std::vector<uint8_t> data (numSystemPages * 125);
+
+    for (auto & b : data)
+    {
+        b = seed ? byte (random) : 0;
+    }
+    makePages (data, 0, m_system.begin());
+
+    data.resize (250);
+    for (unsigned patch = 0; patch < numPatches; ++patch)
+    {
+        for (auto & b : data)
+        {
+            b = seed ? byte (random) : 0;
+        }
+        makePages (data, 14 + 2 * patch, m_patches.begin() + 2 * patch);
+    }
+}
+
+void Emulator::setFaults (const Faults & faults, unsigned seed)
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_faults = faults;
+    m_random.seed (seed);
+}
+
+std::vector<uint8_t> Emulator::patch (unsigned patch) const
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+    std::vector<uint8_t> result;
+    MIDI::unscramblePage (m_patches.at (2 * patch).data(), result);
+    MIDI::unscramblePage (m_patches.at (2 * patch + 1).data(), result);
+    return result;
+}
+
+void Emulator::setPatch (unsigned patch, const std::vector<uint8_t> & data)
+{
+    if (patch >= numPatches || data.size() != 250)
+    {
+        throw std::out_of_range ("Invalid patch");
+    }
+    std::lock_guard<std::mutex> lock (m_mutex);
+    makePages (data, 14 + 2 * patch, m_patches.begin() + 2 * patch);
+}
+
+std::vector<uint8_t> Emulator::system () const
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+    std::vector<uint8_t> result;
+    for (auto & page : m_system)
+    {
+        MIDI::unscramblePage (page.data(), result);
+    }
+    return result;
+}
+
+unsigned Emulator::requests () const
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return m_requests;
+}
+
+unsigned Emulator::writes () const
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return m_writes;
+}
+
+std::vector<uint8_t> & Emulator::page (unsigned page)
+{
+    return page >= 14 ? m_patches.at (page - 14) : m_system.at (page);
+}
+
+bool Emulator::chance (double probability)
+{
+    return probability > 0 && std::uniform_real_distribution<double> (0, 1) (m_random) < probability;
+}
+
+void Emulator::respond (const std::vector<uint8_t> & message, std::vector<std::vector<uint8_t>> & replies)
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+
+    // Identity request
+    if (message.size() == 6 && message[0] == 0xf0 && message[1] == 0x7e && message[3] == 0x06 && message[4] == 0x01)
+    {
+        replies.push_back ({0xf0, 0x7e, 0x10, 0x06, 0x02, 0x41, 0x14, 0x03, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0xf7});
+        return;
+    }
+
+    if (message.size() < 10 || message[0] != 0xf0 || message[1] != 0x41 || message[6] != 0x14)
+    {
+        return;
+    }
+
+    unsigned first = (message[8] << 7) | message[9];
+
+    // RQ1: page range, page 0 means the whole system area
+    if (message[7] == 0x11 && message.size() == 14)
+    {
+        ++m_requests;
+        unsigned length = first == 0 ? numSystemPages : ((message[10] << 7) | message[11]) + 1;
+        for (unsigned p = first; p < first + length && p < 14 + 2 * numPatches; ++p)
+        {
+            if (chance (m_faults.dropRead))
+            {
+                continue;
+            }
+            replies.push_back (p < numSystemPages && first < 14 ? m_system[p] : page (p));
+            if (chance (m_faults.corruptRead))
+            {
+                replies.back()[155 - 2] ^= 0x01;
+            }
+        }
+    }
+
+    // DT1: store one page
+    if (message[7] == 0x12 && message.size() == 155 && first < 14 + 2 * numPatches)
+    {
+        if (!chance (m_faults.dropWrite))
+        {
+            page (first) = message;
+            ++m_writes;
+        }
+    }
+}
+
+LoopbackTransport::Responder Emulator::responder ()
+{
+    return [this] (const std::vector<uint8_t> & message, std::vector<std::vector<uint8_t>> & replies) { respond (message, replies); };
+}
+
+/** State shared with the RtMidi callback of serveVirtualPorts(). */
+struct VirtualPortContext
+{
+    Emulator * emulator;
+    RtMidiOut * out;
+    unsigned bytesPerSecond;
+};
+
+static void serveMessage (double, std::vector<unsigned char> * message, void * userData)
+{
+    auto context = static_cast<VirtualPortContext *> (userData);
+    std::vector<std::vector<uint8_t>> replies;
+    context->emulator->respond (*message, replies);
+
+    for (auto & reply : replies)
+    {
+        context->out->sendMessage (&reply);
+        if (context->bytesPerSecond > 0)
+        {
+            std::this_thread::sleep_for (std::chrono::duration<double> (double (reply.size()) / context->bytesPerSecond));
+        }
+    }
+}
+
+void Emulator::serveVirtualPorts (const std::string & name, unsigned bytesPerSecond)
+{
+    try
+    {
+        RtMidiOut out (RtMidi::UNSPECIFIED, name);
+        out.openVirtualPort (name);
+
+        VirtualPortContext context { this, &out, bytesPerSecond };
+        RtMidiIn in (RtMidi::UNSPECIFIED, name);
+        in.setCallback (&serveMessage, &context);
+        in.ignoreTypes (false, true, true);
+        in.openVirtualPort (name);
+
+        std::cout << "Emulating an ES-8 on the virtual MIDI ports \"" << name << "\". Press Enter to stop." << std::endl;
+        std::string line;
+        std::getline (std::cin, line);
+        in.cancelCallback();
+    }
+    catch (const RtMidiError & error)
+    {
+        error.printMessage();
+        throw std::runtime_error ("Could not open virtual MIDI ports");
+    }
+}
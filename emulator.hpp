@@ -0,0 +1,94 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <random>
+#include <mutex>
+#include <cstdint>
+
+#include "miditransport.hpp"
+
+/**
+ * Software ES-8 for tests and benchmarks.
+ *
+ * Holds the system area (16 pages, 8 * 250 bytes) and 800 patches (2 pages
+ * each, starting at page 14) as ready-to-send DT1 pages. Answers identity
+ * requests, serves RQ1 page ranges and applies DT1 writes. A RQ1 for page 0
+ * returns the whole system area, like the real device.
+ *
+ * Runs in-process behind a LoopbackTransport (see responder()) or on
+ * virtual MIDI ports (see serveVirtualPorts()).
+ */
+class Emulator
+{
+    public:
+        /** Faults to inject, as probabilities between 0 and 1. */
+        struct Faults
+        {
+            /** Served pages that are not sent. */
+            double dropRead = 0;
+            /** Served pages sent with a wrong checksum. */
+            double corruptRead = 0;
+            /** Written pages that are not stored. */
+            double dropWrite = 0;
+        };
+
+        static const unsigned numPatches = 800;
+        static const unsigned numSystemPages = 16;
+
+        /**
+         * Constructor
+         *
+         * @param seed Fill patches and system area with random data from this seed, 0 for all zeros.
+         */
+        Emulator (unsigned seed = 0);
+
+        /** Switch fault injection on or off (all zero). */
+        void setFaults (const Faults & faults, unsigned seed = 1);
+
+        /** Unscrambled data of one patch (250 bytes). */
+        std::vector<uint8_t> patch (unsigned patch) const;
+
+        /** Replace the data of one patch (250 bytes). */
+        void setPatch (unsigned patch, const std::vector<uint8_t> & data);
+
+        /** Unscrambled system area (8 * 250 bytes). */
+        std::vector<uint8_t> system () const;
+
+        /** Number of RQ1 messages handled. */
+        unsigned requests () const;
+
+        /** Number of DT1 pages stored. */
+        unsigned writes () const;
+
+        /** Handle one incoming message and append the replies. */
+        void respond (const std::vector<uint8_t> & message, std::vector<std::vector<uint8_t>> & replies);
+
+        /** Responder for a LoopbackTransport, which provides the throttling. */
+        LoopbackTransport::Responder responder ();
+
+        /**
+         * Serve on virtual MIDI ports until a line is read from standard input.
+         *
+         * @param name Name of the virtual ports.
+         * @param bytesPerSecond Wire speed of the replies, 0 for no limit.
+         */
+        void serveVirtualPorts (const std::string & name, unsigned bytesPerSecond);
+
+    private:
+        std::vector<uint8_t> & page (unsigned page);
+        bool chance (double probability);
+
+        /** Complete DT1 messages of the system area. */
+        std::vector<std::vector<uint8_t>> m_system;
+        /** Complete DT1 messages of the patches, page 14 on. */
+        std::vector<std::vector<uint8_t>> m_patches;
+        Faults m_faults;
+        std::mt19937 m_random;
+        unsigned m_requests;
+        unsigned m_writes;
+        mutable std::mutex m_mutex;
+};
@@ -2,19 +2,26 @@
 /* The file LICENSE contains more information about licensing. */
 
 #include <iostream>
-#include <sstream>
 #include <fstream>
 #include <string>
+#include <algorithm>
 
 #include "es8parameters.hpp"
 #include "es8data.hpp"
 #include "bitcoder.hpp"
+#include "decodeddata.hpp"
 
 void ES8Data::setData (std::vector<uint8_t> & data)
+{
+    setPartialData (data, ~0u);
+}
+
+void ES8Data::setPartialData (std::vector<uint8_t> & data, unsigned validPages)
 {
     if (dataValid(data))
     {
         m_data = data;
+        m_validPages = validPages;
     }
     else
     {
@@ -22,6 +29,12 @@ void ES8Data::setData (std::vector<uint8_t> & data)
     }
 }
 
+bool ES8Data::fieldValid (FieldId id) const
+{
+    unsigned pages = g_fields.at (id).pageMask();
+    return (m_validPages & pages) == pages;
+}
+
 const std::vector<uint8_t> ES8Data::data()
 {
     return m_data;
@@ -34,42 +47,161 @@ std::vector<uint8_t> & ES8Data::writeableData()
 
 void ES8Data::printVerbose()
 {
-    writeFileData (std::cout);
+    std::string text;
+    writeFileData (text);
+    std::cout.write (text.data(), text.size());
+}
+
+void ES8Data::saveValues (const std::string & filename, const std::string & header)
+{
+    // Reused between calls, so exporting many files does not reallocate.
+    static std::string text;
+    text.assign (header);
+    text += '\n';
+    writeFileData (text);
+
+    std::ofstream file (filename);
+    file.write (text.data(), text.size());
+    file.close();
+    if (!file)
+    {
+        throw std::runtime_error ("Could not write " + filename);
+    }
+}
+
+/** Check for blanks, without locale lookups. */
+static bool isBlank (char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
 }
 
-void ES8Data::loadValues (std::ifstream & infile)
+void ES8Data::loadValues (const std::vector<uint8_t> & buffer, const std::string & header, const std::string & formatError)
 {
+    m_validPages = ~0u;
     BitCodec bc (writeableData());
 
-    std::string line;
+    const char * pos = reinterpret_cast<const char *> (buffer.data());
+    const char * bufferEnd = pos + buffer.size();
+    size_t lineNumber = 0;
+    const Field * previous = nullptr;
 
-    while (std::getline(infile, line))
+    while (pos != bufferEnd)
     {
-        std::istringstream conv (line);
-        std::string key, value;
-        std::getline (conv, key, ':');
-        std::getline (conv, value, ':');
-        std::stringstream trim;
-        trim << value;
-        value.clear();
-        trim >> value;
-        std::string id;
-        unsigned index = 1;
-        try
+        ++lineNumber;
+
+        const char * begin = pos;
+        const char * end = std::find (begin, bufferEnd, '\n');
+        pos = end == bufferEnd ? end : end + 1;
+        if (end != begin && end[-1] == '\r')
+        {
+            --end;
+        }
+
+        if (lineNumber == 1)
+        {
+            if (header.compare (0, std::string::npos, begin, end - begin) != 0)
+            {
+                std::cerr << "wrong file format <" << std::string (begin, end) << ">" << std::endl;
+                throw std::runtime_error (formatError);
+            }
+            continue;
+        }
+
+        if (std::all_of (begin, end, isBlank))
+        {
+            continue;
+        }
+
+        // "<key>: <value> [comment]"
+        const char * colon = std::find (begin, end, ':');
+        const char * valueBegin = colon == end ? end : colon + 1;
+        while (valueBegin != end && isBlank (*valueBegin))
+        {
+            ++valueBegin;
+        }
+        const char * valueEnd = valueBegin;
+        while (valueEnd != end && *valueEnd != ':' && !isBlank (*valueEnd))
         {
-            id = g_fields.at(key).id();
+            ++valueEnd;
         }
-        catch (const std::out_of_range & e)
+
+        size_t index = 0;
+        const Field * field = g_fields.resolve (begin, colon - begin, index, previous);
+        if (!field)
         {
-            id = g_fields.at(key.substr(0, key.find_last_of('_')+1)).id();
-	    std::stringstream conv;
-            conv << key.substr(key.find_last_of('_')+1, key.length());
-            conv >> index;
+            throw std::runtime_error ("Unknown field in line " + std::to_string (lineNumber) + ": " + std::string (begin, colon));
         }
 
-        unsigned intValue = g_fields.at(id).value (value);
+        unsigned intValue = 0;
+        if (!field->parseValue (valueBegin, valueEnd - valueBegin, intValue))
+        {
+            throw std::runtime_error ("Invalid value in line " + std::to_string (lineNumber) + ": " + std::string (valueBegin, valueEnd));
+        }
         
-        bc.setValue (g_fields.at(id).bitOffset(index-1), g_fields.at(id).bitLength(), intValue);
+        bc.setValue (field->bitOffset(index), field->bitLength(), intValue);
+        previous = field;
+    }
+
+    if (lineNumber == 0)
+    {
+        std::cerr << "wrong file format <>" << std::endl;
+        throw std::runtime_error (formatError);
+    }
+}
+
+/** One line of a patch or globals file, with its key text precomputed. */
+struct TextLine
+{
+    size_t field;
+    size_t index;
+    std::string key;
+};
+
+/** All lines of a file of the given type, in output order. */
+static const std::vector<TextLine> & textLines (Field::Type type)
+{
+    static std::vector<TextLine> lines[2];
+    std::vector<TextLine> & result = lines[type];
+
+    if (result.empty())
+    {
+        DecodedData dec (type);
+        for (size_t f = 0; f < dec.numFields(); ++f)
+        {
+            const Field & field = dec.field(f);
+            for (size_t i = 0; i < field.numFields(); ++i)
+            {
+                std::string key = field.id();
+                if (field.numFields() != 1)
+                {
+                    key += std::to_string (i + 1);
+                }
+                result.push_back ({f, i, key + ": "});
+            }
+        }
     }
+
+    return result;
 }
 
+void ES8Data::writeValues (std::string & out, Field::Type type)
+{
+    DecodedData dec (type);
+    dec.decode (data());
+
+    for (auto & line : textLines (type))
+    {
+        const Field & field = dec.field (line.field);
+        unsigned value = dec.value (line.field, line.index);
+
+        out += line.key;
+        field.formatValue (value, out);
+        if (g_fields.idOf (field) == FieldId::ID_PATCH_NAME_)
+        {
+            out += " '";
+            out += char(value);
+            out += '\'';
+        }
+        out += '\n';
+    }
+}
@@ -4,7 +4,9 @@
 #pragma once
 
 #include <vector>
-#include <ostream>
+#include <string>
+
+#include "es8parameters.hpp"
 
 ///@todo document
 
@@ -18,13 +20,29 @@ class ES8Data
         void setData (std::vector<uint8_t> & data);
         const std::vector<uint8_t> data();
 
+        /**
+         * Use data of which only some pages were read, the others are
+         * undefined.
+         *
+         * @param data The data, all pages present.
+         * @param validPages Valid pages of 125 bytes, one bit per page.
+         */
+        void setPartialData (std::vector<uint8_t> & data, unsigned validPages);
+
+        /** True if all values of the field are in valid pages. */
+        bool fieldValid (FieldId id) const;
+
     protected:
         virtual bool dataValid(std::vector<uint8_t> & data) = 0;
-        virtual void writeFileData (std::ostream & s) = 0;
-        void loadValues(std::ifstream & infile);
+        virtual void writeFileData (std::string & out) = 0;
+        void loadValues(const std::vector<uint8_t> & buffer, const std::string & header, const std::string & formatError);
+        void saveValues(const std::string & filename, const std::string & header);
+        void writeValues(std::string & out, Field::Type type);
         std::vector<uint8_t> & writeableData();
 
     private:
         std::vector<uint8_t> m_data;
+        /** Pages of m_data that hold valid data, one bit per page. */
+        unsigned m_validPages = ~0u;
 };
 
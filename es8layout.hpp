@@ -0,0 +1,275 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Position and value range of a field in the ES-8 binary configuration.
+ */
+struct FieldLayout
+{
+    size_t bitOffset;
+    size_t bitLength;
+    unsigned min;
+    unsigned max;
+    size_t numFields;
+
+    /** Position of one subindex in bits. */
+    constexpr size_t offset (size_t index = 0) const
+    {
+        return bitOffset + index * bitLength;
+    }
+
+    /** First bit after the last subindex. */
+    constexpr size_t end () const
+    {
+        return bitOffset + numFields * bitLength;
+    }
+};
+
+/**
+ * The reverse engineered ES-8 layout, one constant per field ID.
+ */
+namespace Layout
+{
+    /** Offset of the patch fields following ID_PATCH_UNKNOWN_82_. */
+    constexpr size_t OFFSET_COMP = (8*3+3);
+
+    constexpr FieldLayout ID_SYSTEM_CURRENT_NUM { (8*0+0), 10, 0, 799, 1 };
+    constexpr FieldLayout ID_SYSTEM_PANEL_LOCK { (8*1+2), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_PLAY_OPTION_SW_MODE { (8*1+3), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_PLAY_OPTION_BANK_CHANGE_MODE { (8*1+4), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_PLAY_OPTION_EXT_CTL_TYPE_CTL_ { (8*1+5), 3, 0, 5, 6 };
+    constexpr FieldLayout ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MIN { (8*3+7), 7, 0, 99, 1 };
+    constexpr FieldLayout ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MAX { (8*4+6), 7, 0, 99, 1 };
+    constexpr FieldLayout ID_SYSTEM_PLAY_OPTION_PATCH_CHANGE_TIME { (8*5+5), 4, 0, 10, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_INPUT_SELECT { (8*6+1), 2, 0, 2, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_INPUT_BUFFER { (8*6+3), 2, 0, 2, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_OUTPUT_SELECT { (8*6+5), 2, 0, 3, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_OUTPUT_BUFFER { (8*6+7), 2, 0, 2, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_LOOP7_RETURN_MODE { (8*7+1), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_LOOP8_RETURN_MODE { (8*7+2), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_VOLUME_LOOP_LIFT { (8*7+3), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_MIDI_SETTING_MIDI_OUT_MODE { (8*7+4), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_MIDI_SETTING_RX_CH { (8*7+5), 4, 0, 15, 1 };
+    constexpr FieldLayout ID_SYSTEM_MIDI_SETTING_DEVICE_ID { (8*8+1), 5, 0, 31, 1 };
+    constexpr FieldLayout ID_SYSTEM_MIDI_SETTING_SYNC_CLOCK { (8*8+6), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_MIDI_SETTING_CLOCK_OUT { (8*8+7), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_OTHERS_LCD_CONTRAST { (8*9+0), 4, 0, 9, 1 };
+    constexpr FieldLayout ID_SYSTEM_OTHERS_EXP_POLARITY_ { (8*9+4), 1, 0, 1, 2 };
+    constexpr FieldLayout ID_SYSTEM_OTHERS_CTL_POLARITY_ { (8*9+6), 1, 0, 1, 4 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_MEMORY_MANUAL_SW_MODE { (8*10+2), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_PREFERENCE_MUTE_BYPASS_SW_MODE { (8*10+3), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_MEMORY_MANUAL { (8*10+4), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_SYSTEM_UNKNOWN_10 { (8*10+5), 3, 0, 7, 1 };
+    constexpr FieldLayout ID_SYSTEM_UNKNOWN_11_ { (8*11+0), 4, 0, 15, 228 };
+
+    constexpr FieldLayout ID_SYSTEM_PC_MAP_BANK_PC_ { 8 * 250 + (8*0+0), 10, 0, 799, 7 * 128 };
+
+    constexpr FieldLayout ID_PATCH_LOOP_SW_LOOP_ { (8*0+0), 1, 0, 1, 8 }; // V is 9
+    constexpr FieldLayout ID_PATCH_LOOP_SW_LOOP_V { (8*1+0), 1, 0, 1, 1 }; // V is 9
+    constexpr FieldLayout ID_PATCH_LOOP_POSITION_ { (8*1+1), 4, 0, 12, 16 };
+    constexpr FieldLayout ID_PATCH_CARRY_OVER_LOOP_ { (8*9+1), 1, 0, 1, 9 };
+    constexpr FieldLayout ID_PATCH_UNKNOWN_82_ { (8*10+2), 3, 0, 7, 9 };
+    constexpr FieldLayout ID_PATCH_INPUT_SELECT { OFFSET_COMP + (8*10+2), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_INPUT_BUFFER { OFFSET_COMP + (8*10+3), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_OUTPUT_SELECT { OFFSET_COMP + (8*10+4), 2, 0, 2, 1 };
+    constexpr FieldLayout ID_PATCH_OUTPUT_BUFFER { OFFSET_COMP + (8*10+6), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_OUTPUT_GAIN { OFFSET_COMP + (8*10+7), 2, 0, 3, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_ { OFFSET_COMP + (8*11+1), 9, 0, 500, 6 };
+    constexpr FieldLayout ID_PATCH_EXP_ { OFFSET_COMP + (8*17+7), 8, 0, 129, 2 };
+    constexpr FieldLayout ID_PATCH_MASTER_BPM { OFFSET_COMP + (8*19+7), 9, 20, 500, 1 };
+    constexpr FieldLayout ID_PATCH_NAME_ { OFFSET_COMP + (8*21+0), 7, 0x20, 0x7e, 16 };
+    constexpr FieldLayout ID_PATCH_LED_NUM_ { OFFSET_COMP + (8*35+0), 1, 0, 1, 8 };
+    constexpr FieldLayout ID_PATCH_LED_BANK_D { OFFSET_COMP + (8*36+0), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_LED_BANK_U { OFFSET_COMP + (8*36+1), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_MIDI_TX_CH_ { OFFSET_COMP + (8*36+2), 5, 0, 16, 8 };
+    constexpr FieldLayout ID_PATCH_MIDI_PC_BANK_LSB_ { OFFSET_COMP + (8*41+2), 8, 0, 128, 8 };
+    constexpr FieldLayout ID_PATCH_MIDI_PC_BANK_MSB_ { OFFSET_COMP + (8*49+2), 8, 0, 128, 8 };
+    constexpr FieldLayout ID_PATCH_MIDI_PC_ { OFFSET_COMP + (8*57+2), 8, 0, 128, 8 };
+    constexpr FieldLayout ID_PATCH_MIDI_CTL1_CC_ { OFFSET_COMP + (8*65+2), 8, 0, 128, 8 };
+    constexpr FieldLayout ID_PATCH_MIDI_CTL1_CC_VAL_ { OFFSET_COMP + (8*73+2), 7, 0, 127, 8 };
+    constexpr FieldLayout ID_PATCH_MIDI_CTL2_CC_ { OFFSET_COMP + (8*80+2), 8, 0, 128, 8 };
+    constexpr FieldLayout ID_PATCH_MIDI_CTL2_CC_VAL_ { OFFSET_COMP + (8*88+2), 7, 0, 127, 8 };
+    constexpr FieldLayout ID_PATCH_CTL_FUNC_MEM_MAN { OFFSET_COMP + (8*95+2), 5, 0, 21, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_FUNC_MUTE { OFFSET_COMP + (8*95+7), 5, 0, 21, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_FUNC_BANK_D { OFFSET_COMP + (8*96+4), 5, 0, 21, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_FUNC_BANK_U { OFFSET_COMP + (8*97+1), 5, 0, 21, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_FUNC_NUM_ { OFFSET_COMP + (8*97+6), 5, 0, 21, 8 };
+    constexpr FieldLayout ID_PATCH_CTL_FUNC_CTL_IN_ { OFFSET_COMP + (8*102+6), 5, 0, 21, 4 };
+    constexpr FieldLayout ID_PATCH_CTL_MIN_MEM_MAN { OFFSET_COMP + (8*105+2), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MIN_MUTE { OFFSET_COMP + (8*105+3), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MIN_BANK_D { OFFSET_COMP + (8*105+4), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MIN_BANK_U { OFFSET_COMP + (8*105+5), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MIN_NUM_ { OFFSET_COMP + (8*105+6), 1, 0, 1, 8 };
+    constexpr FieldLayout ID_PATCH_CTL_MIN_CTL_IN_ { OFFSET_COMP + (8*106+6), 1, 0, 1, 4 };
+    constexpr FieldLayout ID_PATCH_CTL_MAX_MEM_MAN { OFFSET_COMP + (8*107+2), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MAX_MUTE { OFFSET_COMP + (8*107+3), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MAX_BANK_D { OFFSET_COMP + (8*107+4), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MAX_BANK_U { OFFSET_COMP + (8*107+5), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_CTL_MAX_NUM_ { OFFSET_COMP + (8*107+6), 1, 0, 1, 8 };
+    constexpr FieldLayout ID_PATCH_CTL_MAX_CTL_IN_ { OFFSET_COMP + (8*108+6), 1, 0, 1, 4 };
+    constexpr FieldLayout ID_PATCH_CTL_MOD { OFFSET_COMP + (8*109+2), 1, 0, 1, 1 };
+    constexpr FieldLayout ID_PATCH_UNKNOWN_112_ { OFFSET_COMP + (8*109+3), 3, 0, 7, 5 };
+    constexpr FieldLayout ID_PATCH_EXP_FUNC_ { OFFSET_COMP + (8*111+2), 2, 0, 3, 2 };
+    constexpr FieldLayout ID_PATCH_EXP_MIN_ { OFFSET_COMP + (8*111+6), 9, 0, 500, 2 };
+    constexpr FieldLayout ID_PATCH_EXP_MAX_ { OFFSET_COMP + (8*114+0), 9, 0, 500, 2 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_SW_ { OFFSET_COMP + (8*116+2), 1, 0, 1, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_SOURCE_ { OFFSET_COMP + (8*117+6), 5, 0, 21, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_MODE_ { OFFSET_COMP + (8*125+2), 1, 0, 1, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_TARGET_ { OFFSET_COMP + (8*126+6), 6, 0, 37, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_TARGET_CC_CH_ { OFFSET_COMP + (8*135+6), 4, 0, 15, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_TARGET_CC_NO_ { OFFSET_COMP + (8*141+6), 7, 0, 127, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_TARGET_MIN_ { OFFSET_COMP + (8*152+2), 9, 0, 511, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_TARGET_MAX_ { OFFSET_COMP + (8*165+6), 9, 0, 511, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_ACT_RANGE_LO_ { OFFSET_COMP + (8*179+2), 7, 0, 126, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_ACT_RANGE_HI_ { OFFSET_COMP + (8*189+6), 7, 1, 127, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_ { OFFSET_COMP + (8*200+2), 5, 0, 24, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_CC_ { OFFSET_COMP + (8*207+6), 7, 0, 127, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_INT_PEDAL_TIME_ { OFFSET_COMP + (8*218+2), 7, 0, 100, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_INT_PEDAL_CURVE_ { OFFSET_COMP + (8*228+6), 2, 0, 2, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_WAVE_PEDAL_RATE_ { OFFSET_COMP + (8*231+6), 7, 1, 120, 12 };
+    constexpr FieldLayout ID_PATCH_ASSIGN_WAVE_PEDAL_FORM_ { OFFSET_COMP + (8*242+2), 2, 0, 2, 12 };
+    constexpr FieldLayout ID_PATCH_UNKNOWN_248 { OFFSET_COMP + (8*245+2), 11, 0, 2047, 1 };
+
+    /** Fields in the first system page (125 bytes). */
+    constexpr FieldLayout systemFields[] =
+    {
+        ID_SYSTEM_CURRENT_NUM,
+        ID_SYSTEM_PANEL_LOCK,
+        ID_SYSTEM_PLAY_OPTION_SW_MODE,
+        ID_SYSTEM_PLAY_OPTION_BANK_CHANGE_MODE,
+        ID_SYSTEM_PLAY_OPTION_EXT_CTL_TYPE_CTL_,
+        ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MIN,
+        ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MAX,
+        ID_SYSTEM_PLAY_OPTION_PATCH_CHANGE_TIME,
+        ID_SYSTEM_PREFERENCE_INPUT_SELECT,
+        ID_SYSTEM_PREFERENCE_INPUT_BUFFER,
+        ID_SYSTEM_PREFERENCE_OUTPUT_SELECT,
+        ID_SYSTEM_PREFERENCE_OUTPUT_BUFFER,
+        ID_SYSTEM_PREFERENCE_LOOP7_RETURN_MODE,
+        ID_SYSTEM_PREFERENCE_LOOP8_RETURN_MODE,
+        ID_SYSTEM_PREFERENCE_VOLUME_LOOP_LIFT,
+        ID_SYSTEM_MIDI_SETTING_MIDI_OUT_MODE,
+        ID_SYSTEM_MIDI_SETTING_RX_CH,
+        ID_SYSTEM_MIDI_SETTING_DEVICE_ID,
+        ID_SYSTEM_MIDI_SETTING_SYNC_CLOCK,
+        ID_SYSTEM_MIDI_SETTING_CLOCK_OUT,
+        ID_SYSTEM_OTHERS_LCD_CONTRAST,
+        ID_SYSTEM_OTHERS_EXP_POLARITY_,
+        ID_SYSTEM_OTHERS_CTL_POLARITY_,
+        ID_SYSTEM_PREFERENCE_MEMORY_MANUAL_SW_MODE,
+        ID_SYSTEM_PREFERENCE_MUTE_BYPASS_SW_MODE,
+        ID_SYSTEM_MEMORY_MANUAL,
+        ID_SYSTEM_UNKNOWN_10,
+        ID_SYSTEM_UNKNOWN_11_
+    };
+
+    /** Fields in a patch (250 bytes). */
+    constexpr FieldLayout patchFields[] =
+    {
+        ID_PATCH_LOOP_SW_LOOP_,
+        ID_PATCH_LOOP_SW_LOOP_V,
+        ID_PATCH_LOOP_POSITION_,
+        ID_PATCH_CARRY_OVER_LOOP_,
+        ID_PATCH_UNKNOWN_82_,
+        ID_PATCH_INPUT_SELECT,
+        ID_PATCH_INPUT_BUFFER,
+        ID_PATCH_OUTPUT_SELECT,
+        ID_PATCH_OUTPUT_BUFFER,
+        ID_PATCH_OUTPUT_GAIN,
+        ID_PATCH_CTL_,
+        ID_PATCH_EXP_,
+        ID_PATCH_MASTER_BPM,
+        ID_PATCH_NAME_,
+        ID_PATCH_LED_NUM_,
+        ID_PATCH_LED_BANK_D,
+        ID_PATCH_LED_BANK_U,
+        ID_PATCH_MIDI_TX_CH_,
+        ID_PATCH_MIDI_PC_BANK_LSB_,
+        ID_PATCH_MIDI_PC_BANK_MSB_,
+        ID_PATCH_MIDI_PC_,
+        ID_PATCH_MIDI_CTL1_CC_,
+        ID_PATCH_MIDI_CTL1_CC_VAL_,
+        ID_PATCH_MIDI_CTL2_CC_,
+        ID_PATCH_MIDI_CTL2_CC_VAL_,
+        ID_PATCH_CTL_FUNC_MEM_MAN,
+        ID_PATCH_CTL_FUNC_MUTE,
+        ID_PATCH_CTL_FUNC_BANK_D,
+        ID_PATCH_CTL_FUNC_BANK_U,
+        ID_PATCH_CTL_FUNC_NUM_,
+        ID_PATCH_CTL_FUNC_CTL_IN_,
+        ID_PATCH_CTL_MIN_MEM_MAN,
+        ID_PATCH_CTL_MIN_MUTE,
+        ID_PATCH_CTL_MIN_BANK_D,
+        ID_PATCH_CTL_MIN_BANK_U,
+        ID_PATCH_CTL_MIN_NUM_,
+        ID_PATCH_CTL_MIN_CTL_IN_,
+        ID_PATCH_CTL_MAX_MEM_MAN,
+        ID_PATCH_CTL_MAX_MUTE,
+        ID_PATCH_CTL_MAX_BANK_D,
+        ID_PATCH_CTL_MAX_BANK_U,
+        ID_PATCH_CTL_MAX_NUM_,
+        ID_PATCH_CTL_MAX_CTL_IN_,
+        ID_PATCH_CTL_MOD,
+        ID_PATCH_UNKNOWN_112_,
+        ID_PATCH_EXP_FUNC_,
+        ID_PATCH_EXP_MIN_,
+        ID_PATCH_EXP_MAX_,
+        ID_PATCH_ASSIGN_SW_,
+        ID_PATCH_ASSIGN_SOURCE_,
+        ID_PATCH_ASSIGN_MODE_,
+        ID_PATCH_ASSIGN_TARGET_,
+        ID_PATCH_ASSIGN_TARGET_CC_CH_,
+        ID_PATCH_ASSIGN_TARGET_CC_NO_,
+        ID_PATCH_ASSIGN_TARGET_MIN_,
+        ID_PATCH_ASSIGN_TARGET_MAX_,
+        ID_PATCH_ASSIGN_ACT_RANGE_LO_,
+        ID_PATCH_ASSIGN_ACT_RANGE_HI_,
+        ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_,
+        ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_CC_,
+        ID_PATCH_ASSIGN_INT_PEDAL_TIME_,
+        ID_PATCH_ASSIGN_INT_PEDAL_CURVE_,
+        ID_PATCH_ASSIGN_WAVE_PEDAL_RATE_,
+        ID_PATCH_ASSIGN_WAVE_PEDAL_FORM_,
+        ID_PATCH_UNKNOWN_248
+    };
+
+    /** Check that a field is non-empty, fits into its bits and has a sane range. */
+    constexpr bool valid (const FieldLayout & f)
+    {
+        return f.bitLength > 0 && f.bitLength <= 16 && f.numFields > 0 && f.min <= f.max && f.max < (1u << f.bitLength);
+    }
+
+    /**
+     * Check that a set of fields covers the bits [0, bits) exactly once:
+     * all fields valid and in range, no two overlapping and no gaps.
+     */
+    template <size_t N>
+    constexpr bool coversExactly (const FieldLayout (&fields)[N], size_t bits)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (!valid (fields[i]) || fields[i].end() > bits)
+            {
+                return false;
+            }
+            for (size_t j = i + 1; j < N; ++j)
+            {
+                if (fields[i].bitOffset < fields[j].end() && fields[j].bitOffset < fields[i].end())
+                {
+                    return false;
+                }
+            }
+            total += fields[i].end() - fields[i].bitOffset;
+        }
+        return total == bits;
+    }
+
+    static_assert (coversExactly (systemFields, 8 * 125), "Corrupted system field map");
+    static_assert (coversExactly (patchFields, 8 * 250), "Corrupted patch field map");
+    static_assert (valid (ID_SYSTEM_PC_MAP_BANK_PC_) && ID_SYSTEM_PC_MAP_BANK_PC_.bitOffset >= 8 * 125 && ID_SYSTEM_PC_MAP_BANK_PC_.end() <= 8 * 8 * 250, "Corrupted PC map");
+}
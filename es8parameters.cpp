@@ -3,102 +3,391 @@
 
 #include <string>
 #include <vector>
-#include <map>
-#include <sstream>
+#include <stdexcept>
+#include <cstdint>
 #include "es8parameters.hpp"
-#include "helpers.h"
+#include "es8layout.hpp"
 
-/** Singleton field map. */
-std::map<std::string, Field> g_fields;
+/** Hash of an alias name (FNV-1a). */
+static constexpr size_t aliasHash (const char * str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash = (hash ^ (unsigned char) str[i]) * 16777619u;
+    }
+    return hash;
+}
 
-/** Add an entry to the field map. */
-void registerField (Field::Type type, std::string id, size_t bitOffset, size_t bitLength, unsigned min, unsigned max, unsigned numFields=1, AliasMap alias = AliasMap());
+static constexpr size_t constexprStrlen (const char * str)
+{
+    size_t len = 0;
+    while (str[len])
+    {
+        ++len;
+    }
+    return len;
+}
 
-/** Add all known ES-8 entries to the field map. */
-void initReverseEngineeredFields ();
+/** Hash slots of one alias table, see AliasTable. */
+struct AliasSlots
+{
+    static constexpr size_t size = 32;
+    unsigned char slot[size];
+};
 
-/** Singleton field map initializer class. */
-class FieldInitializer
+/** Build the hash slots of an alias table at compile time, with linear probing. */
+template <size_t N>
+static constexpr AliasSlots makeAliasSlots (const char * const (&names)[N])
 {
-    public:
-        FieldInitializer ()
+    static_assert (2 * N <= AliasSlots::size, "Alias table too large for its hash slots");
+
+    AliasSlots result {};
+    for (size_t i = 0; i < N; ++i)
+    {
+        size_t pos = aliasHash (names[i], constexprStrlen (names[i])) & (AliasSlots::size - 1);
+        while (result.slot[pos] != 0)
         {
-            initReverseEngineeredFields();
+            pos = (pos + 1) & (AliasSlots::size - 1);
         }
+        result.slot[pos] = (unsigned char) (i + 1);
+    }
+    return result;
+}
+
+bool AliasTable::find (const char * str, size_t len, unsigned & value) const
+{
+    for (size_t pos = aliasHash (str, len) & slotMask; slots[pos] != 0; pos = (pos + 1) & slotMask)
+    {
+        const char * candidate = names[slots[pos] - 1];
+        if (std::strlen (candidate) == len && std::memcmp (candidate, str, len) == 0)
+        {
+            value = slots[pos] - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+#define ALIAS_TABLE(name, ...) \
+    static constexpr const char * name##Names[] = { __VA_ARGS__ }; \
+    static constexpr AliasSlots name##Slots = makeAliasSlots (name##Names); \
+    static constexpr AliasTable name { name##Names, sizeof (name##Names) / sizeof (name##Names[0]), name##Slots.slot, AliasSlots::size - 1 }
+
+/** Named values shared between fields, the position of a name is its value. */
+ALIAS_TABLE (onoff, "OFF", "ON");
+ALIAS_TABLE (loops, "LOOP_1", "LOOP_2", "LOOP_3", "LOOP_4", "LOOP_5", "LOOP_6", "LOOP_7", "LOOP_8", "LOOP_V");
+ALIAS_TABLE (inputs, "IN_1", "IN_2");
+ALIAS_TABLE (outputs, "OUT_1", "OUT_2", "BOTH");
+ALIAS_TABLE (gain, "0_DB", "+2_DB", "+4_DB", "+6_DB");
+
+#undef ALIAS_TABLE
+
+/** All known ES-8 fields, sorted by name. The order defines FieldId. */
+static constexpr Field s_fields[] =
+{
+    Field (Field::Patch, "ID_PATCH_ASSIGN_ACT_RANGE_HI_", Layout::ID_PATCH_ASSIGN_ACT_RANGE_HI_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_ACT_RANGE_LO_", Layout::ID_PATCH_ASSIGN_ACT_RANGE_LO_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_CURVE_", Layout::ID_PATCH_ASSIGN_INT_PEDAL_CURVE_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_TIME_", Layout::ID_PATCH_ASSIGN_INT_PEDAL_TIME_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_", Layout::ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_CC_", Layout::ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_CC_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_MODE_", Layout::ID_PATCH_ASSIGN_MODE_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_SOURCE_", Layout::ID_PATCH_ASSIGN_SOURCE_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_SW_", Layout::ID_PATCH_ASSIGN_SW_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_TARGET_", Layout::ID_PATCH_ASSIGN_TARGET_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_TARGET_CC_CH_", Layout::ID_PATCH_ASSIGN_TARGET_CC_CH_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_TARGET_CC_NO_", Layout::ID_PATCH_ASSIGN_TARGET_CC_NO_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_TARGET_MAX_", Layout::ID_PATCH_ASSIGN_TARGET_MAX_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_TARGET_MIN_", Layout::ID_PATCH_ASSIGN_TARGET_MIN_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_WAVE_PEDAL_FORM_", Layout::ID_PATCH_ASSIGN_WAVE_PEDAL_FORM_),
+    Field (Field::Patch, "ID_PATCH_ASSIGN_WAVE_PEDAL_RATE_", Layout::ID_PATCH_ASSIGN_WAVE_PEDAL_RATE_),
+    Field (Field::Patch, "ID_PATCH_CARRY_OVER_LOOP_", Layout::ID_PATCH_CARRY_OVER_LOOP_, &onoff),
+    Field (Field::Patch, "ID_PATCH_CTL_", Layout::ID_PATCH_CTL_),
+    Field (Field::Patch, "ID_PATCH_CTL_FUNC_BANK_D", Layout::ID_PATCH_CTL_FUNC_BANK_D),
+    Field (Field::Patch, "ID_PATCH_CTL_FUNC_BANK_U", Layout::ID_PATCH_CTL_FUNC_BANK_U),
+    Field (Field::Patch, "ID_PATCH_CTL_FUNC_CTL_IN_", Layout::ID_PATCH_CTL_FUNC_CTL_IN_),
+    Field (Field::Patch, "ID_PATCH_CTL_FUNC_MEM_MAN", Layout::ID_PATCH_CTL_FUNC_MEM_MAN),
+    Field (Field::Patch, "ID_PATCH_CTL_FUNC_MUTE", Layout::ID_PATCH_CTL_FUNC_MUTE),
+    Field (Field::Patch, "ID_PATCH_CTL_FUNC_NUM_", Layout::ID_PATCH_CTL_FUNC_NUM_),
+    Field (Field::Patch, "ID_PATCH_CTL_MAX_BANK_D", Layout::ID_PATCH_CTL_MAX_BANK_D),
+    Field (Field::Patch, "ID_PATCH_CTL_MAX_BANK_U", Layout::ID_PATCH_CTL_MAX_BANK_U),
+    Field (Field::Patch, "ID_PATCH_CTL_MAX_CTL_IN_", Layout::ID_PATCH_CTL_MAX_CTL_IN_),
+    Field (Field::Patch, "ID_PATCH_CTL_MAX_MEM_MAN", Layout::ID_PATCH_CTL_MAX_MEM_MAN),
+    Field (Field::Patch, "ID_PATCH_CTL_MAX_MUTE", Layout::ID_PATCH_CTL_MAX_MUTE),
+    Field (Field::Patch, "ID_PATCH_CTL_MAX_NUM_", Layout::ID_PATCH_CTL_MAX_NUM_),
+    Field (Field::Patch, "ID_PATCH_CTL_MIN_BANK_D", Layout::ID_PATCH_CTL_MIN_BANK_D),
+    Field (Field::Patch, "ID_PATCH_CTL_MIN_BANK_U", Layout::ID_PATCH_CTL_MIN_BANK_U),
+    Field (Field::Patch, "ID_PATCH_CTL_MIN_CTL_IN_", Layout::ID_PATCH_CTL_MIN_CTL_IN_),
+    Field (Field::Patch, "ID_PATCH_CTL_MIN_MEM_MAN", Layout::ID_PATCH_CTL_MIN_MEM_MAN),
+    Field (Field::Patch, "ID_PATCH_CTL_MIN_MUTE", Layout::ID_PATCH_CTL_MIN_MUTE),
+    Field (Field::Patch, "ID_PATCH_CTL_MIN_NUM_", Layout::ID_PATCH_CTL_MIN_NUM_),
+    Field (Field::Patch, "ID_PATCH_CTL_MOD", Layout::ID_PATCH_CTL_MOD),
+    Field (Field::Patch, "ID_PATCH_EXP_", Layout::ID_PATCH_EXP_),
+    Field (Field::Patch, "ID_PATCH_EXP_FUNC_", Layout::ID_PATCH_EXP_FUNC_),
+    Field (Field::Patch, "ID_PATCH_EXP_MAX_", Layout::ID_PATCH_EXP_MAX_),
+    Field (Field::Patch, "ID_PATCH_EXP_MIN_", Layout::ID_PATCH_EXP_MIN_),
+    Field (Field::Patch, "ID_PATCH_INPUT_BUFFER", Layout::ID_PATCH_INPUT_BUFFER, &onoff),
+    Field (Field::Patch, "ID_PATCH_INPUT_SELECT", Layout::ID_PATCH_INPUT_SELECT, &inputs),
+    Field (Field::Patch, "ID_PATCH_LED_BANK_D", Layout::ID_PATCH_LED_BANK_D, &onoff),
+    Field (Field::Patch, "ID_PATCH_LED_BANK_U", Layout::ID_PATCH_LED_BANK_U, &onoff),
+    Field (Field::Patch, "ID_PATCH_LED_NUM_", Layout::ID_PATCH_LED_NUM_, &onoff),
+    Field (Field::Patch, "ID_PATCH_LOOP_POSITION_", Layout::ID_PATCH_LOOP_POSITION_, &loops),
+    Field (Field::Patch, "ID_PATCH_LOOP_SW_LOOP_", Layout::ID_PATCH_LOOP_SW_LOOP_, &onoff),
+    Field (Field::Patch, "ID_PATCH_LOOP_SW_LOOP_V", Layout::ID_PATCH_LOOP_SW_LOOP_V, &onoff),
+    Field (Field::Patch, "ID_PATCH_MASTER_BPM", Layout::ID_PATCH_MASTER_BPM),
+    Field (Field::Patch, "ID_PATCH_MIDI_CTL1_CC_", Layout::ID_PATCH_MIDI_CTL1_CC_),
+    Field (Field::Patch, "ID_PATCH_MIDI_CTL1_CC_VAL_", Layout::ID_PATCH_MIDI_CTL1_CC_VAL_),
+    Field (Field::Patch, "ID_PATCH_MIDI_CTL2_CC_", Layout::ID_PATCH_MIDI_CTL2_CC_),
+    Field (Field::Patch, "ID_PATCH_MIDI_CTL2_CC_VAL_", Layout::ID_PATCH_MIDI_CTL2_CC_VAL_),
+    Field (Field::Patch, "ID_PATCH_MIDI_PC_", Layout::ID_PATCH_MIDI_PC_),
+    Field (Field::Patch, "ID_PATCH_MIDI_PC_BANK_LSB_", Layout::ID_PATCH_MIDI_PC_BANK_LSB_),
+    Field (Field::Patch, "ID_PATCH_MIDI_PC_BANK_MSB_", Layout::ID_PATCH_MIDI_PC_BANK_MSB_),
+    Field (Field::Patch, "ID_PATCH_MIDI_TX_CH_", Layout::ID_PATCH_MIDI_TX_CH_),
+    Field (Field::Patch, "ID_PATCH_NAME_", Layout::ID_PATCH_NAME_),
+    Field (Field::Patch, "ID_PATCH_OUTPUT_BUFFER", Layout::ID_PATCH_OUTPUT_BUFFER, &onoff),
+    Field (Field::Patch, "ID_PATCH_OUTPUT_GAIN", Layout::ID_PATCH_OUTPUT_GAIN, &gain),
+    Field (Field::Patch, "ID_PATCH_OUTPUT_SELECT", Layout::ID_PATCH_OUTPUT_SELECT, &outputs),
+    Field (Field::Patch, "ID_PATCH_UNKNOWN_112_", Layout::ID_PATCH_UNKNOWN_112_),
+    Field (Field::Patch, "ID_PATCH_UNKNOWN_248", Layout::ID_PATCH_UNKNOWN_248),
+    Field (Field::Patch, "ID_PATCH_UNKNOWN_82_", Layout::ID_PATCH_UNKNOWN_82_),
+    Field (Field::Globals, "ID_SYSTEM_CURRENT_NUM", Layout::ID_SYSTEM_CURRENT_NUM),
+    Field (Field::Globals, "ID_SYSTEM_MEMORY_MANUAL", Layout::ID_SYSTEM_MEMORY_MANUAL),
+    Field (Field::Globals, "ID_SYSTEM_MIDI_SETTING_CLOCK_OUT", Layout::ID_SYSTEM_MIDI_SETTING_CLOCK_OUT),
+    Field (Field::Globals, "ID_SYSTEM_MIDI_SETTING_DEVICE_ID", Layout::ID_SYSTEM_MIDI_SETTING_DEVICE_ID),
+    Field (Field::Globals, "ID_SYSTEM_MIDI_SETTING_MIDI_OUT_MODE", Layout::ID_SYSTEM_MIDI_SETTING_MIDI_OUT_MODE),
+    Field (Field::Globals, "ID_SYSTEM_MIDI_SETTING_RX_CH", Layout::ID_SYSTEM_MIDI_SETTING_RX_CH),
+    Field (Field::Globals, "ID_SYSTEM_MIDI_SETTING_SYNC_CLOCK", Layout::ID_SYSTEM_MIDI_SETTING_SYNC_CLOCK),
+    Field (Field::Globals, "ID_SYSTEM_OTHERS_CTL_POLARITY_", Layout::ID_SYSTEM_OTHERS_CTL_POLARITY_),
+    Field (Field::Globals, "ID_SYSTEM_OTHERS_EXP_POLARITY_", Layout::ID_SYSTEM_OTHERS_EXP_POLARITY_),
+    Field (Field::Globals, "ID_SYSTEM_OTHERS_LCD_CONTRAST", Layout::ID_SYSTEM_OTHERS_LCD_CONTRAST),
+    Field (Field::Globals, "ID_SYSTEM_PANEL_LOCK", Layout::ID_SYSTEM_PANEL_LOCK),
+    Field (Field::Globals, "ID_SYSTEM_PC_MAP_BANK_PC_", Layout::ID_SYSTEM_PC_MAP_BANK_PC_),
+    Field (Field::Globals, "ID_SYSTEM_PLAY_OPTION_BANK_CHANGE_MODE", Layout::ID_SYSTEM_PLAY_OPTION_BANK_CHANGE_MODE),
+    Field (Field::Globals, "ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MAX", Layout::ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MAX),
+    Field (Field::Globals, "ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MIN", Layout::ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MIN),
+    Field (Field::Globals, "ID_SYSTEM_PLAY_OPTION_EXT_CTL_TYPE_CTL_", Layout::ID_SYSTEM_PLAY_OPTION_EXT_CTL_TYPE_CTL_),
+    Field (Field::Globals, "ID_SYSTEM_PLAY_OPTION_PATCH_CHANGE_TIME", Layout::ID_SYSTEM_PLAY_OPTION_PATCH_CHANGE_TIME),
+    Field (Field::Globals, "ID_SYSTEM_PLAY_OPTION_SW_MODE", Layout::ID_SYSTEM_PLAY_OPTION_SW_MODE),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_INPUT_BUFFER", Layout::ID_SYSTEM_PREFERENCE_INPUT_BUFFER),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_INPUT_SELECT", Layout::ID_SYSTEM_PREFERENCE_INPUT_SELECT),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_LOOP7_RETURN_MODE", Layout::ID_SYSTEM_PREFERENCE_LOOP7_RETURN_MODE),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_LOOP8_RETURN_MODE", Layout::ID_SYSTEM_PREFERENCE_LOOP8_RETURN_MODE),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_MEMORY_MANUAL_SW_MODE", Layout::ID_SYSTEM_PREFERENCE_MEMORY_MANUAL_SW_MODE),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_MUTE_BYPASS_SW_MODE", Layout::ID_SYSTEM_PREFERENCE_MUTE_BYPASS_SW_MODE),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_OUTPUT_BUFFER", Layout::ID_SYSTEM_PREFERENCE_OUTPUT_BUFFER),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_OUTPUT_SELECT", Layout::ID_SYSTEM_PREFERENCE_OUTPUT_SELECT),
+    Field (Field::Globals, "ID_SYSTEM_PREFERENCE_VOLUME_LOOP_LIFT", Layout::ID_SYSTEM_PREFERENCE_VOLUME_LOOP_LIFT),
+    Field (Field::Globals, "ID_SYSTEM_UNKNOWN_10", Layout::ID_SYSTEM_UNKNOWN_10),
+    Field (Field::Globals, "ID_SYSTEM_UNKNOWN_11_", Layout::ID_SYSTEM_UNKNOWN_11_)
 };
 
-/** Singleton field map initializer. */
-static FieldInitializer g_fieldInitializer;
+static_assert (sizeof(s_fields) / sizeof(s_fields[0]) == size_t (FieldId::Count), "FieldId does not match the field table");
 
-Field::Field (Field::Type type, std::string id, size_t bitOffset, size_t bitLength, unsigned min, unsigned max, unsigned numFields, const AliasMap & alias)
+/** Compare two strings at compile time. */
+constexpr int constexprStrcmp (const char * a, const char * b)
 {
-    m_type = type;
-    m_id = id;
-    m_bitOffset = bitOffset;
-    m_bitLength = bitLength;
-    m_min = min;
-    m_max = max;
-    m_numFields = numFields;
-    m_alias = alias;
+    while (*a && *a == *b)
+    {
+        ++a;
+        ++b;
+    }
+    return (unsigned char) *a - (unsigned char) *b;
 }
 
-Field::Type Field::type() 
-{ 
-    return m_type; 
+/** Check that the field table is strictly sorted by name. */
+constexpr bool sortedById (const Field * fields, size_t count)
+{
+    for (size_t i = 1; i < count; ++i)
+    {
+        if (constexprStrcmp (fields[i-1].id(), fields[i].id()) >= 0)
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
-std::string Field::id() 
+static_assert (sortedById (s_fields, size_t (FieldId::Count)), "Field table must be sorted by name");
+
+/** Singleton field registry. */
+const FieldRegistry g_fields (s_fields, size_t (FieldId::Count));
+
+Field::Type Field::type() const
 { 
-    return m_id; 
+    return m_type; 
 }
 
-size_t Field::bitOffset(size_t index)
+size_t Field::bitOffset(size_t index) const
 {
     return m_bitOffset + index * m_bitLength;
 }
 
-size_t Field::bitLength() { return m_bitLength; }
-unsigned Field::min() { return m_min; }
-unsigned Field::max() { return m_max; }
-size_t Field::numFields() { return m_numFields; }
-std::string Field::value(unsigned value)
+unsigned Field::pageMask() const
 {
-    if (m_alias.find(value) == m_alias.end())
+    const size_t pageBits = 125 * 8;
+    unsigned mask = 0;
+    for (size_t page = bitOffset() / pageBits; page <= (bitOffset(m_numFields - 1) + m_bitLength - 1) / pageBits; ++page)
     {
-	std::stringstream conv;
-	conv << value;
-	return conv.str();
+        mask |= 1u << page;
     }
-    else
+    return mask;
+}
+
+size_t Field::bitLength() const { return m_bitLength; }
+unsigned Field::min() const { return m_min; }
+unsigned Field::max() const { return m_max; }
+size_t Field::numFields() const { return m_numFields; }
+std::string Field::value(unsigned value) const
+{
+    std::string result;
+    formatValue (value, result);
+    return result;
+}
+
+void Field::formatValue(unsigned value, std::string & out) const
+{
+    const char * name = m_alias ? m_alias->name (value) : nullptr;
+    if (name)
     {
-	return m_alias[value];
+        out += name;
+        return;
+    }
+
+    char digits[10];
+    size_t n = 0;
+    do
+    {
+        digits[n++] = char('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (n > 0)
+    {
+        out += digits[--n];
     }
 }
 
-unsigned Field::value(std::string value)
+unsigned Field::value(std::string value) const
 {
-    for (auto it = m_alias.begin (); it != m_alias.end(); ++it)
+    unsigned result = 0;
+    if (!parseValue (value.data(), value.size(), result))
     {
-        if (it->second == value)
+        throw std::runtime_error ("Invalid value");
+    }
+    return result;
+}
+
+bool Field::parseValue(const char * str, size_t len, unsigned & result) const
+{
+    if (m_alias && m_alias->find (str, len, result))
+    {
+        return true;
+    }
+
+    if (len == 0 || len > 9)
+    {
+        return false;
+    }
+
+    result = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (str[i] < '0' || str[i] > '9')
         {
-            return it->first;
+            return false;
         }
+        result = result * 10 + (str[i] - '0');
     }
+    return true;
+}
 
-    if (!onlyDigits(value))
+const Field & FieldRegistry::at (const std::string & id) const
+{
+    auto result = find (id.data(), id.size());
+    if (!result)
     {
-        throw std::runtime_error ("Invalid value");
+        throw std::out_of_range ("Unknown field " + id);
     }
+    return *result;
+}
 
-    std::stringstream conv (value);
-    unsigned result;
-    conv >> result;
-    return result;
+const Field * FieldRegistry::find (const char * id, size_t len) const
+{
+    // Compare a registered name with a name that is not null terminated.
+    auto compare = [] (const char * name, const char * id, size_t len) {
+        int cmp = std::strncmp (name, id, len);
+        if (cmp != 0)
+        {
+            return cmp;
+        }
+        return name[len] == 0 ? 0 : 1;
+    };
+
+    size_t lo = 0;
+    size_t hi = m_count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        int cmp = compare (m_fields[mid].id(), id, len);
+        if (cmp == 0)
+        {
+            return &m_fields[mid];
+        }
+        if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return nullptr;
 }
 
-void registerField (Field::Type type, std::string id, size_t bitOffset, size_t bitLength, unsigned min, unsigned max, unsigned numFields, AliasMap alias)
+const Field * FieldRegistry::resolve (const char * key, size_t len, size_t & index, const Field * hint) const
 {
-    g_fields.emplace (std::make_pair (id,Field (type, id, bitOffset, bitLength, min, max, numFields, alias)));
+    index = 0;
+    const Field * result = nullptr;
+
+    // Split "<prefix>_<N>" into the field prefix and the 1-based subindex.
+    size_t pos = len;
+    while (pos > 0 && key[pos-1] >= '0' && key[pos-1] <= '9')
+    {
+        --pos;
+    }
+    if (pos == len || pos == 0 || key[pos-1] != '_' || len - pos > 4)
+    {
+        return find (key, len);
+    }
+
+    size_t n = 0;
+    for (size_t i = pos; i < len; ++i)
+    {
+        n = n * 10 + (key[i] - '0');
+    }
+
+    if (hint && std::strlen (hint->id()) == pos && std::memcmp (hint->id(), key, pos) == 0)
+    {
+        result = hint;
+    }
+    else if ((result = find (key, len)))
+    {
+        // Names such as ID_SYSTEM_UNKNOWN_10 end in digits themselves.
+        return result;
+    }
+    else
+    {
+        result = find (key, pos);
+    }
+
+    if (!result || n < 1 || n > result->numFields())
+    {
+        return nullptr;
+    }
+    index = n - 1;
+    return result;
 }
 
 #if 0
@@ -197,140 +486,3 @@ void initDocumentedFields ()
     registerField (2, "ID_PATCH_ASSIGN_WAVE_PEDAL_FORM_", (8*242+2), 2, 0, 2, 12);
 }
 #endif
-
-#define OFFSET_COMP (8*3+3)
-
-void initReverseEngineeredFields ()
-{
-    AliasMap onoff;
-    onoff[0] = "OFF";
-    onoff[1] = "ON";
-
-    AliasMap loops;
-    loops[0] = "LOOP_1";
-    loops[1] = "LOOP_2";
-    loops[2] = "LOOP_3";
-    loops[3] = "LOOP_4";
-    loops[4] = "LOOP_5";
-    loops[5] = "LOOP_6";
-    loops[6] = "LOOP_7";
-    loops[7] = "LOOP_8";
-    loops[8] = "LOOP_V";
-
-    AliasMap inputs;
-    inputs[0] = "IN_1";
-    inputs[1] = "IN_2";
-
-    AliasMap outputs;
-    outputs[0] = "OUT_1";
-    outputs[1] = "OUT_2";
-    outputs[2] = "BOTH";
-
-    AliasMap gain;
-    gain[0] = "0_DB";
-    gain[1] = "+2_DB";
-    gain[2] = "+4_DB";
-    gain[3] = "+6_DB";
-
-    registerField (Field::Globals, "ID_SYSTEM_CURRENT_NUM", (8*0+0), 10, 0, 799);
-    registerField (Field::Globals, "ID_SYSTEM_PANEL_LOCK", (8*1+2), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_PLAY_OPTION_SW_MODE", (8*1+3), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_PLAY_OPTION_BANK_CHANGE_MODE", (8*1+4), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_PLAY_OPTION_EXT_CTL_TYPE_CTL_", (8*1+5), 3, 0, 5, 6);
-    registerField (Field::Globals, "ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MIN", (8*3+7), 7, 0, 99);
-    registerField (Field::Globals, "ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MAX", (8*4+6), 7, 0, 99);
-    registerField (Field::Globals, "ID_SYSTEM_PLAY_OPTION_PATCH_CHANGE_TIME", (8*5+5), 4, 0, 10);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_INPUT_SELECT", (8*6+1), 2, 0, 2);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_INPUT_BUFFER", (8*6+3), 2, 0, 2);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_OUTPUT_SELECT", (8*6+5), 2, 0, 3);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_OUTPUT_BUFFER", (8*6+7), 2, 0, 2);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_LOOP7_RETURN_MODE", (8*7+1), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_LOOP8_RETURN_MODE", (8*7+2), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_VOLUME_LOOP_LIFT", (8*7+3), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_MIDI_SETTING_MIDI_OUT_MODE", (8*7+4), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_MIDI_SETTING_RX_CH", (8*7+5), 4, 0, 15);
-    registerField (Field::Globals, "ID_SYSTEM_MIDI_SETTING_DEVICE_ID", (8*8+1), 5, 0, 31);
-    registerField (Field::Globals, "ID_SYSTEM_MIDI_SETTING_SYNC_CLOCK", (8*8+6), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_MIDI_SETTING_CLOCK_OUT", (8*8+7), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_OTHERS_LCD_CONTRAST", (8*9+0), 4, 0, 9);
-    registerField (Field::Globals, "ID_SYSTEM_OTHERS_EXP_POLARITY_", (8*9+4), 1, 0, 1, 2);
-    registerField (Field::Globals, "ID_SYSTEM_OTHERS_CTL_POLARITY_", (8*9+6), 1, 0, 1, 4);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_MEMORY_MANUAL_SW_MODE", (8*10+2), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_PREFERENCE_MUTE_BYPASS_SW_MODE", (8*10+3), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_MEMORY_MANUAL", (8*10+4), 1, 0, 1);
-    registerField (Field::Globals, "ID_SYSTEM_UNKNOWN_10", (8*10+5), 3, 0, 7);
-    registerField (Field::Globals, "ID_SYSTEM_UNKNOWN_11_", (8*11+0), 4, 0, 15, 228);
-
-    registerField (Field::Globals, "ID_SYSTEM_PC_MAP_BANK_PC_", 8 * 250 + (8*0+0), 10, 0, 799, 7 * 128);
-
-    registerField (Field::Patch, "ID_PATCH_LOOP_SW_LOOP_", (8*0+0), 1, 0, 1, 8, onoff); // V is 9
-    registerField (Field::Patch, "ID_PATCH_LOOP_SW_LOOP_V", (8*1+0), 1, 0, 1, 1, onoff); // V is 9
-    registerField (Field::Patch, "ID_PATCH_LOOP_POSITION_", (8*1+1), 4, 0, 12, 16, loops);
-    registerField (Field::Patch, "ID_PATCH_CARRY_OVER_LOOP_", (8*9+1), 1, 0, 1, 9, onoff);
-
-    registerField (Field::Patch, "ID_PATCH_UNKNOWN_82_", (8*10+2), 3, 0, 7, 9);
-    registerField (Field::Patch, "ID_PATCH_INPUT_SELECT", OFFSET_COMP + (8*10+2), 1, 0, 1, 1, inputs);
-    registerField (Field::Patch, "ID_PATCH_INPUT_BUFFER", OFFSET_COMP + (8*10+3), 1, 0, 1, 1, onoff);
-    registerField (Field::Patch, "ID_PATCH_OUTPUT_SELECT", OFFSET_COMP + (8*10+4), 2, 0, 2, 1, outputs);
-    registerField (Field::Patch, "ID_PATCH_OUTPUT_BUFFER", OFFSET_COMP + (8*10+6), 1, 0, 1, 1, onoff);
-    registerField (Field::Patch, "ID_PATCH_OUTPUT_GAIN", OFFSET_COMP + (8*10+7), 2, 0, 3, 1, gain);
-    registerField (Field::Patch, "ID_PATCH_CTL_", OFFSET_COMP + (8*11+1), 9, 0, 500, 6);
-    registerField (Field::Patch, "ID_PATCH_EXP_", OFFSET_COMP + (8*17+7), 8, 0, 129, 2);
-    registerField (Field::Patch, "ID_PATCH_MASTER_BPM", OFFSET_COMP + (8*19+7), 9, 20, 500);
-    registerField (Field::Patch, "ID_PATCH_NAME_", OFFSET_COMP + (8*21+0), 7, 0x20, 0x7e, 16);
-    registerField (Field::Patch, "ID_PATCH_LED_NUM_", OFFSET_COMP + (8*35+0), 1, 0, 1, 8, onoff);
-    registerField (Field::Patch, "ID_PATCH_LED_BANK_D", OFFSET_COMP + (8*36+0), 1, 0, 1, 1, onoff);
-    registerField (Field::Patch, "ID_PATCH_LED_BANK_U", OFFSET_COMP + (8*36+1), 1, 0, 1, 1, onoff);
-    registerField (Field::Patch, "ID_PATCH_MIDI_TX_CH_", OFFSET_COMP + (8*36+2), 5, 0, 16, 8);
-    registerField (Field::Patch, "ID_PATCH_MIDI_PC_BANK_LSB_", OFFSET_COMP + (8*41+2), 8, 0, 128, 8);
-    registerField (Field::Patch, "ID_PATCH_MIDI_PC_BANK_MSB_", OFFSET_COMP + (8*49+2), 8, 0, 128, 8);
-    registerField (Field::Patch, "ID_PATCH_MIDI_PC_", OFFSET_COMP + (8*57+2), 8, 0, 128, 8);
-    registerField (Field::Patch, "ID_PATCH_MIDI_CTL1_CC_", OFFSET_COMP + (8*65+2), 8, 0, 128, 8);
-    registerField (Field::Patch, "ID_PATCH_MIDI_CTL1_CC_VAL_", OFFSET_COMP + (8*73+2), 7, 0, 127, 8);
-    registerField (Field::Patch, "ID_PATCH_MIDI_CTL2_CC_", OFFSET_COMP + (8*80+2), 8, 0, 128, 8);
-    registerField (Field::Patch, "ID_PATCH_MIDI_CTL2_CC_VAL_", OFFSET_COMP + (8*88+2), 7, 0, 127, 8);
-    registerField (Field::Patch, "ID_PATCH_CTL_FUNC_MEM_MAN", OFFSET_COMP + (8*95+2), 5, 0, 21);
-    registerField (Field::Patch, "ID_PATCH_CTL_FUNC_MUTE", OFFSET_COMP + (8*95+7), 5, 0, 21);
-    registerField (Field::Patch, "ID_PATCH_CTL_FUNC_BANK_D", OFFSET_COMP + (8*96+4), 5, 0, 21);
-    registerField (Field::Patch, "ID_PATCH_CTL_FUNC_BANK_U", OFFSET_COMP + (8*97+1), 5, 0, 21);
-    registerField (Field::Patch, "ID_PATCH_CTL_FUNC_NUM_", OFFSET_COMP + (8*97+6), 5, 0, 21, 8);
-    registerField (Field::Patch, "ID_PATCH_CTL_FUNC_CTL_IN_", OFFSET_COMP + (8*102+6), 5, 0, 21, 4);
-    registerField (Field::Patch, "ID_PATCH_CTL_MIN_MEM_MAN", OFFSET_COMP + (8*105+2), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MIN_MUTE", OFFSET_COMP + (8*105+3), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MIN_BANK_D", OFFSET_COMP + (8*105+4), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MIN_BANK_U", OFFSET_COMP + (8*105+5), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MIN_NUM_", OFFSET_COMP + (8*105+6), 1, 0, 1, 8);
-    registerField (Field::Patch, "ID_PATCH_CTL_MIN_CTL_IN_", OFFSET_COMP + (8*106+6), 1, 0, 1, 4);
-    registerField (Field::Patch, "ID_PATCH_CTL_MAX_MEM_MAN", OFFSET_COMP + (8*107+2), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MAX_MUTE", OFFSET_COMP + (8*107+3), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MAX_BANK_D", OFFSET_COMP + (8*107+4), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MAX_BANK_U", OFFSET_COMP + (8*107+5), 1, 0, 1);
-    registerField (Field::Patch, "ID_PATCH_CTL_MAX_NUM_", OFFSET_COMP + (8*107+6), 1, 0, 1, 8);
-    registerField (Field::Patch, "ID_PATCH_CTL_MAX_CTL_IN_", OFFSET_COMP + (8*108+6), 1, 0, 1, 4);
-    registerField (Field::Patch, "ID_PATCH_CTL_MOD", OFFSET_COMP + (8*109+2), 1, 0, 1);
-
-    registerField (Field::Patch, "ID_PATCH_UNKNOWN_112_", OFFSET_COMP + (8*109+3), 3, 0, 7, 5);
-
-    registerField (Field::Patch, "ID_PATCH_EXP_FUNC_", OFFSET_COMP + (8*111+2), 2, 0, 3, 2);
-    registerField (Field::Patch, "ID_PATCH_EXP_MIN_", OFFSET_COMP + (8*111+6), 9, 0, 500, 2);
-    registerField (Field::Patch, "ID_PATCH_EXP_MAX_", OFFSET_COMP + (8*114+0), 9, 0, 500, 2);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_SW_", OFFSET_COMP + (8*116+2), 1, 0, 1, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_SOURCE_", OFFSET_COMP + (8*117+6), 5, 0, 21, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_MODE_", OFFSET_COMP + (8*125+2), 1, 0, 1, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_TARGET_", OFFSET_COMP + (8*126+6), 6, 0, 37, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_TARGET_CC_CH_", OFFSET_COMP + (8*135+6), 4, 0, 15, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_TARGET_CC_NO_", OFFSET_COMP + (8*141+6), 7, 0, 127, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_TARGET_MIN_", OFFSET_COMP + (8*152+2), 9, 0, 511, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_TARGET_MAX_", OFFSET_COMP + (8*165+6), 9, 0, 511, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_ACT_RANGE_LO_", OFFSET_COMP + (8*179+2), 7, 0, 126, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_ACT_RANGE_HI_", OFFSET_COMP + (8*189+6), 7, 1, 127, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_", OFFSET_COMP + (8*200+2), 5, 0, 24, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_CC_", OFFSET_COMP + (8*207+6), 7, 0, 127, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_TIME_", OFFSET_COMP + (8*218+2), 7, 0, 100, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_INT_PEDAL_CURVE_", OFFSET_COMP + (8*228+6), 2, 0, 2, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_WAVE_PEDAL_RATE_", OFFSET_COMP + (8*231+6), 7, 1, 120, 12);
-    registerField (Field::Patch, "ID_PATCH_ASSIGN_WAVE_PEDAL_FORM_", OFFSET_COMP + (8*242+2), 2, 0, 2, 12);
-
-    registerField (Field::Patch, "ID_PATCH_UNKNOWN_248", OFFSET_COMP + (8*245+2), 11, 0, 2047, 1);
-}
-
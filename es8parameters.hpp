@@ -4,13 +4,42 @@
 #pragma once
 
 #include <string>
-#include <vector>
-#include <map>
-#include <sstream>
+#include <cstring>
 
-///@todo document
+#include "es8layout.hpp"
 
-typedef std::map<unsigned, std::string> AliasMap;
+/**
+ * The named values of a field, shared between fields.
+ *
+ * Named values are always 0 to count-1, so names are looked up directly by
+ * value. The reverse direction uses an open addressing hash table built at
+ * compile time.
+ */
+struct AliasTable
+{
+    /** Names, indexed by value. */
+    const char * const * names;
+    size_t count;
+    /** Hash slots, holding the value plus one or 0 if the slot is empty. */
+    const unsigned char * slots;
+    size_t slotMask;
+
+    /** Name of a value or nullptr if the value has no name. */
+    const char * name (unsigned value) const
+    {
+        return value < count ? names[value] : nullptr;
+    }
+
+    /**
+     * Look up a name.
+     *
+     * @param str The name, not necessarily null terminated.
+     * @param len Length of the name.
+     * @param value Receives the value.
+     * @return False if the name is unknown.
+     */
+    bool find (const char * str, size_t len, unsigned & value) const;
+};
 
 /**
  * Describe a field in the ES-8 binary configuration.
@@ -19,30 +48,224 @@ class Field
 {
     public:
         typedef enum { Globals, Patch } Type;
-        Field (Type type, std::string id, size_t bitOffset, size_t bitLength, unsigned min, unsigned max, unsigned numFields=1, const AliasMap & alias = AliasMap());
 
-        Type type();
-        std::string id();
+        constexpr Field (Type type, const char * id, const FieldLayout & layout, const AliasTable * alias = nullptr)
+            : m_type (type), m_id (id), m_bitOffset (layout.bitOffset), m_bitLength (layout.bitLength),
+              m_min (layout.min), m_max (layout.max), m_numFields (layout.numFields), m_alias (alias)
+        {
+        }
+
+        Type type() const;
+        constexpr const char * id() const
+        {
+            return m_id;
+        }
         
-        size_t bitOffset(size_t index = 0);
+        size_t bitOffset(size_t index = 0) const;
+
+        size_t bitLength() const;
+        unsigned min() const;
+        unsigned max() const;
+        size_t numFields() const;
 
-        size_t bitLength();
-        unsigned min();
-        unsigned max();
-        size_t numFields();
-        std::string value(unsigned value);
-        unsigned value(std::string value);
+        /**
+         * Pages of the data holding any value of this field, one bit per
+         * page of 125 bytes as transferred in one DT1 message.
+         */
+        unsigned pageMask() const;
+
+        std::string value(unsigned value) const;
+        unsigned value(std::string value) const;
+
+        /**
+         * Convert an alias or a decimal number to a value, without exceptions.
+         *
+         * @param str The text, not necessarily null terminated.
+         * @param len Length of the text.
+         * @param result Receives the value.
+         * @return False if the text is neither an alias nor a number.
+         */
+        bool parseValue(const char * str, size_t len, unsigned & result) const;
+
+        /**
+         * Append the alias or the decimal representation of a value.
+         *
+         * @param value The value.
+         * @param out String to append to.
+         */
+        void formatValue(unsigned value, std::string & out) const;
 
     private:
         Type m_type;
-        std::string m_id;
+        const char * m_id;
         size_t m_bitOffset;
         size_t m_bitLength;
         unsigned m_min;
         unsigned m_max;
         size_t m_numFields;
-        AliasMap m_alias;
+        const AliasTable * m_alias;
 };
 
-extern std::map<std::string, Field> g_fields;
+/**
+ * Handle for a field in the registry, for code that does not need the name.
+ * The order matches the registry, which is sorted by name.
+ */
+enum class FieldId : unsigned short
+{
+    ID_PATCH_ASSIGN_ACT_RANGE_HI_,
+    ID_PATCH_ASSIGN_ACT_RANGE_LO_,
+    ID_PATCH_ASSIGN_INT_PEDAL_CURVE_,
+    ID_PATCH_ASSIGN_INT_PEDAL_TIME_,
+    ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_,
+    ID_PATCH_ASSIGN_INT_PEDAL_TRIGGER_CC_,
+    ID_PATCH_ASSIGN_MODE_,
+    ID_PATCH_ASSIGN_SOURCE_,
+    ID_PATCH_ASSIGN_SW_,
+    ID_PATCH_ASSIGN_TARGET_,
+    ID_PATCH_ASSIGN_TARGET_CC_CH_,
+    ID_PATCH_ASSIGN_TARGET_CC_NO_,
+    ID_PATCH_ASSIGN_TARGET_MAX_,
+    ID_PATCH_ASSIGN_TARGET_MIN_,
+    ID_PATCH_ASSIGN_WAVE_PEDAL_FORM_,
+    ID_PATCH_ASSIGN_WAVE_PEDAL_RATE_,
+    ID_PATCH_CARRY_OVER_LOOP_,
+    ID_PATCH_CTL_,
+    ID_PATCH_CTL_FUNC_BANK_D,
+    ID_PATCH_CTL_FUNC_BANK_U,
+    ID_PATCH_CTL_FUNC_CTL_IN_,
+    ID_PATCH_CTL_FUNC_MEM_MAN,
+    ID_PATCH_CTL_FUNC_MUTE,
+    ID_PATCH_CTL_FUNC_NUM_,
+    ID_PATCH_CTL_MAX_BANK_D,
+    ID_PATCH_CTL_MAX_BANK_U,
+    ID_PATCH_CTL_MAX_CTL_IN_,
+    ID_PATCH_CTL_MAX_MEM_MAN,
+    ID_PATCH_CTL_MAX_MUTE,
+    ID_PATCH_CTL_MAX_NUM_,
+    ID_PATCH_CTL_MIN_BANK_D,
+    ID_PATCH_CTL_MIN_BANK_U,
+    ID_PATCH_CTL_MIN_CTL_IN_,
+    ID_PATCH_CTL_MIN_MEM_MAN,
+    ID_PATCH_CTL_MIN_MUTE,
+    ID_PATCH_CTL_MIN_NUM_,
+    ID_PATCH_CTL_MOD,
+    ID_PATCH_EXP_,
+    ID_PATCH_EXP_FUNC_,
+    ID_PATCH_EXP_MAX_,
+    ID_PATCH_EXP_MIN_,
+    ID_PATCH_INPUT_BUFFER,
+    ID_PATCH_INPUT_SELECT,
+    ID_PATCH_LED_BANK_D,
+    ID_PATCH_LED_BANK_U,
+    ID_PATCH_LED_NUM_,
+    ID_PATCH_LOOP_POSITION_,
+    ID_PATCH_LOOP_SW_LOOP_,
+    ID_PATCH_LOOP_SW_LOOP_V,
+    ID_PATCH_MASTER_BPM,
+    ID_PATCH_MIDI_CTL1_CC_,
+    ID_PATCH_MIDI_CTL1_CC_VAL_,
+    ID_PATCH_MIDI_CTL2_CC_,
+    ID_PATCH_MIDI_CTL2_CC_VAL_,
+    ID_PATCH_MIDI_PC_,
+    ID_PATCH_MIDI_PC_BANK_LSB_,
+    ID_PATCH_MIDI_PC_BANK_MSB_,
+    ID_PATCH_MIDI_TX_CH_,
+    ID_PATCH_NAME_,
+    ID_PATCH_OUTPUT_BUFFER,
+    ID_PATCH_OUTPUT_GAIN,
+    ID_PATCH_OUTPUT_SELECT,
+    ID_PATCH_UNKNOWN_112_,
+    ID_PATCH_UNKNOWN_248,
+    ID_PATCH_UNKNOWN_82_,
+    ID_SYSTEM_CURRENT_NUM,
+    ID_SYSTEM_MEMORY_MANUAL,
+    ID_SYSTEM_MIDI_SETTING_CLOCK_OUT,
+    ID_SYSTEM_MIDI_SETTING_DEVICE_ID,
+    ID_SYSTEM_MIDI_SETTING_MIDI_OUT_MODE,
+    ID_SYSTEM_MIDI_SETTING_RX_CH,
+    ID_SYSTEM_MIDI_SETTING_SYNC_CLOCK,
+    ID_SYSTEM_OTHERS_CTL_POLARITY_,
+    ID_SYSTEM_OTHERS_EXP_POLARITY_,
+    ID_SYSTEM_OTHERS_LCD_CONTRAST,
+    ID_SYSTEM_PANEL_LOCK,
+    ID_SYSTEM_PC_MAP_BANK_PC_,
+    ID_SYSTEM_PLAY_OPTION_BANK_CHANGE_MODE,
+    ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MAX,
+    ID_SYSTEM_PLAY_OPTION_BANK_EXTENT_MIN,
+    ID_SYSTEM_PLAY_OPTION_EXT_CTL_TYPE_CTL_,
+    ID_SYSTEM_PLAY_OPTION_PATCH_CHANGE_TIME,
+    ID_SYSTEM_PLAY_OPTION_SW_MODE,
+    ID_SYSTEM_PREFERENCE_INPUT_BUFFER,
+    ID_SYSTEM_PREFERENCE_INPUT_SELECT,
+    ID_SYSTEM_PREFERENCE_LOOP7_RETURN_MODE,
+    ID_SYSTEM_PREFERENCE_LOOP8_RETURN_MODE,
+    ID_SYSTEM_PREFERENCE_MEMORY_MANUAL_SW_MODE,
+    ID_SYSTEM_PREFERENCE_MUTE_BYPASS_SW_MODE,
+    ID_SYSTEM_PREFERENCE_OUTPUT_BUFFER,
+    ID_SYSTEM_PREFERENCE_OUTPUT_SELECT,
+    ID_SYSTEM_PREFERENCE_VOLUME_LOOP_LIFT,
+    ID_SYSTEM_UNKNOWN_10,
+    ID_SYSTEM_UNKNOWN_11_,
+    Count
+};
+
+/**
+ * Read-only table of all known fields, sorted by name.
+ *
+ * The table is constant data; there is no initialization at startup.
+ */
+class FieldRegistry
+{
+    public:
+        constexpr FieldRegistry (const Field * fields, size_t count) : m_fields (fields), m_count (count)
+        {
+        }
+
+        /** Field by handle. */
+        const Field & at (FieldId id) const
+        {
+            return m_fields[size_t (id)];
+        }
+
+        /** Field by name. Throws std::out_of_range for unknown names. */
+        const Field & at (const std::string & id) const;
+
+        /**
+         * Field by name, without exceptions.
+         *
+         * @param id Name of the field, not necessarily null terminated.
+         * @param len Length of the name.
+         * @return The field or nullptr if the name is unknown.
+         */
+        const Field * find (const char * id, size_t len) const;
+
+        /**
+         * Resolve a file key such as "ID_PATCH_NAME_7" to a field and
+         * subindex, without exceptions. Keys without a numeric suffix
+         * refer to subindex 0.
+         *
+         * @param key The key, not necessarily null terminated.
+         * @param len Length of the key.
+         * @param index Receives the 0-based subindex.
+         * @param hint Field to try first, e.g. the one of the previous line.
+         * @return The field or nullptr if the key is unknown or the
+         *         subindex is out of range.
+         */
+        const Field * resolve (const char * key, size_t len, size_t & index, const Field * hint = nullptr) const;
+
+        /** Handle of a field from this registry. */
+        FieldId idOf (const Field & field) const
+        {
+            return FieldId (&field - m_fields);
+        }
+
+        const Field * begin () const { return m_fields; }
+        const Field * end () const { return m_fields + m_count; }
+        size_t size () const { return m_count; }
+
+    private:
+        const Field * m_fields;
+        size_t m_count;
+};
 
+extern const FieldRegistry g_fields;
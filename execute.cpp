@@ -3,7 +3,18 @@
 
 #include "execute.hpp"
 #include <iostream>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <sys/stat.h>
+#include <set>
+#include <algorithm>
+#include <chrono>
 #include "midi.hpp"
+#include "miditransport.hpp"
+#include "pagecache.hpp"
 #include "patch.hpp"
 
 bool validateProgram(CmdLineParameters config)
@@ -15,20 +26,197 @@ bool validateProgram(CmdLineParameters config)
     return true;
 }
 
-void runProgram(CmdLineParameters config)
+/**
+ * Patches the program reads from the ES-8, each once, in program order.
+ *
+ * A patch read again, or read after the program has written it, is left
+ * out: with MIDI::reuseKnownPages() it comes from what was read or written
+ * before. So all reads can be sent up front, before any write.
+ */
+static std::vector<unsigned> programReads (const std::list<Command> & commands)
+{
+    std::vector<unsigned> patches;
+    std::set<unsigned> known;
+    std::vector<std::pair<unsigned, unsigned>> restored;
+    auto read = [&] (const Command::Parameter & p) {
+        if (!p.isNumber())
+        {
+            return;
+        }
+        bool wasRestored = std::any_of (restored.begin(), restored.end(), [&] (const std::pair<unsigned, unsigned> & r) { return p.num() >= r.first && p.num() <= r.second; });
+        if (!wasRestored && known.insert (p.num()).second)
+        {
+            patches.push_back (p.num());
+        }
+    };
+    auto write = [&] (const Command::Parameter & p) {
+        if (p.isNumber())
+        {
+            known.insert (p.num());
+        }
+    };
+
+    for (auto & cmd : commands)
+    {
+        switch (cmd.command ())
+        {
+            case CommandType::Select:
+            case CommandType::View:
+                read (cmd.parameter(0));
+                break;
+            case CommandType::Copy:
+                read (cmd.parameter(0));
+                write (cmd.parameter(1));
+                break;
+            case CommandType::Store:
+                write (cmd.parameter(0));
+                break;
+            case CommandType::Restore:
+                // A malformed restore is reported when it runs
+                if (cmd.parameter(0).isNumber() && cmd.parameter(1).isNumber())
+                {
+                    restored.push_back ({cmd.parameter(0).num(), cmd.parameter(1).num()});
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return patches;
+}
+
+bool runProgram(CmdLineParameters config)
+{
+    // One session for the whole program, connected on the first transfer.
+    std::unique_ptr<MIDI> midi;
+    std::unique_ptr<PageCache> cache;
+    ReplayTransport * replay = nullptr;
+    if (config.hasMidi)
+    {
+        std::unique_ptr<MidiTransport> transport;
+        if (!config.replayFile.empty())
+        {
+            replay = new ReplayTransport (config.replayFile);
+            transport.reset (replay);
+        }
+        else if (!config.rawMidiDevice.empty())
+        {
+#if defined(__LINUX_ALSA__)
+            transport.reset (new AlsaRawMidiTransport (config.rawMidiDevice));
+#else
+            throw std::runtime_error ("Raw MIDI devices are only supported on Linux with ALSA");
+#endif
+        }
+        else
+        {
+            transport.reset (new RtMidiTransport (config.midiin, config.midiout));
+        }
+        if (!config.recordFile.empty())
+        {
+            transport.reset (new RecordingTransport (std::move (transport), config.recordFile));
+        }
+
+        // 8N1 framing: 10 bits per byte
+        midi.reset (new MIDI (std::move (transport), config.midibaud / 10));
+        if (!config.cacheFile.empty())
+        {
+            cache.reset (new PageCache (config.cacheFile));
+            midi->setCache (cache.get(), config.refresh);
+        }
+    }
+
+    runCommands (config.commands, midi.get());
+
+    if (cache)
+    {
+        cache->save();
+    }
+
+    if (replay && replay->mismatches() != 0)
+    {
+        std::cerr << "Replay: " << replay->mismatches() << " sent messages differ from the recording" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void runCommands (const std::list<Command> & commands, MIDI * midi)
 {
     std::vector<uint8_t> data; 
     size_t count = 1;
-    for (auto it : config.commands)
+
+    if (midi)
+    {
+        // All reads go out first as a few planned requests, repeated reads
+        // and reads of written patches need no request at all.
+        midi->reuseKnownPages (true);
+        auto reads = programReads (commands);
+        if (reads.size() > 1)
+        {
+            midi->prefetchPatches (reads);
+        }
+    }
+
+    // Writes form one paced stream, confirmed regularly to adapt the pacing
+    const unsigned confirmInterval = 16;
+    unsigned confirmed = midi ? midi->writeStats().pages : 0;
+    for (auto it : commands)
     {
         std::cout << count++ << ": ";
-        executeCommand(it, data, config);
+        executeCommand(it, data, midi);
         std::cout << std::endl;
+
+        if (midi && midi->writeStats().pages - confirmed >= confirmInterval)
+        {
+            midi->confirmWrites();
+            confirmed = midi->writeStats().pages;
+        }
+    }
+    if (midi && midi->writeStats().pages != confirmed)
+    {
+        midi->confirmWrites();
+    }
+}
+
+
+/** File name of a patch in a backup directory. */
+static std::string backupFileName (const std::string & dir, unsigned patch)
+{
+    char filename[16];
+    std::snprintf (filename, sizeof (filename), "/%03u.es8", patch);
+    return dir + filename;
+}
+
+/** File in a backup directory that records how far an unfinished backup got. */
+static std::string backupProgressFileName (const std::string & dir)
+{
+    return dir + "/progress";
+}
+
+/**
+ * First patch still to save for a backup of first..last, after the saved
+ * patches recorded by an earlier run that did not finish.
+ */
+static unsigned backupResumePoint (const std::string & dir, unsigned first, unsigned last)
+{
+    std::ifstream file (backupProgressFileName (dir));
+    std::string header;
+    unsigned f, l, next;
+    if (std::getline (file, header) && header == "ES8cli backup progress 1" && file >> f >> l >> next && f == first && l == last && next > first && next <= last)
+    {
+        return next;
     }
+    return first;
 }
 
+/** Record that all patches before next are saved. */
+static void writeBackupProgress (const std::string & dir, unsigned first, unsigned last, unsigned next)
+{
+    std::ofstream file (backupProgressFileName (dir));
+    file << "ES8cli backup progress 1" << std::endl << first << " " << last << " " << next << std::endl;
+}
 
-void executeCommand (const Command & cmd, std::vector<uint8_t> & data, const CmdLineParameters & config)
+void executeCommand (const Command & cmd, std::vector<uint8_t> & data, MIDI * midi)
 {
     Patch ptch;
     switch (cmd.command ())
@@ -49,10 +237,9 @@ void executeCommand (const Command & cmd, std::vector<uint8_t> & data, const Cmd
             }
             else
             {
-                if (config.hasMidi)
+                if (midi)
                 {
-                    MIDI midi (config.midiin, config.midiout);
-	            data = midi.retrievePatch (cmd.parameter(0).num());
+	            data = midi->retrievePatch (cmd.parameter(0).num());
                     ptch.setData(data);
                 }
                 else
@@ -68,13 +255,13 @@ void executeCommand (const Command & cmd, std::vector<uint8_t> & data, const Cmd
             break;
         case CommandType::View:
             std::cout << "=== View " << cmd.parameter(0).str() << " ===" << std::endl;
-            executeCommand (Command(CommandType::Select, cmd.parameter(0)), data, config);
-            executeCommand (Command(CommandType::Display), data, config);
+            executeCommand (Command(CommandType::Select, cmd.parameter(0)), data, midi);
+            executeCommand (Command(CommandType::Display), data, midi);
             break;
         case CommandType::Copy:
             std::cout << "=== Copy " << cmd.parameter(0).str() << " to " << cmd.parameter(1).str() << " ===" << std::endl;
-            executeCommand (Command(CommandType::Select, cmd.parameter(0)), data, config);
-            executeCommand (Command(CommandType::Store, cmd.parameter(1)), data, config);
+            executeCommand (Command(CommandType::Select, cmd.parameter(0)), data, midi);
+            executeCommand (Command(CommandType::Store, cmd.parameter(1)), data, midi);
             break;
         case CommandType::Store:
             std::cout << "=== Store " << cmd.parameter(0).str() << " ===" << std::endl;
@@ -92,10 +279,11 @@ void executeCommand (const Command & cmd, std::vector<uint8_t> & data, const Cmd
             }
             else
             {
-                if (config.hasMidi)
+                if (midi)
                 {
-                    MIDI midi (config.midiin, config.midiout);
-                    midi.sendPatch (cmd.parameter(0).num(), data);
+                    auto sent = midi->writeStats().pages;
+                    midi->sendPatch (cmd.parameter(0).num(), data);
+                    std::cout << "Sent " << midi->writeStats().pages - sent << " of 2 pages." << std::endl;
                 }
                 else
                 {
@@ -184,6 +372,133 @@ void executeCommand (const Command & cmd, std::vector<uint8_t> & data, const Cmd
             data = ptch.data();
             break;
 
+        case CommandType::Backup:
+            std::cout << "=== Backup " << cmd.parameter(0).str() << " to " << cmd.parameter(1).str() << " into " << cmd.parameter(2).str() << " ===" << std::endl;
+            if (cmd.parameter(1).num() < cmd.parameter(0).num())
+            {
+                throw std::runtime_error ("Invalid patch range.");
+            }
+            if (midi)
+            {
+                std::string dir = cmd.parameter(2).str();
+                if (mkdir (dir.c_str(), 0755) != 0 && errno != EEXIST)
+                {
+                    throw std::runtime_error ("Could not create directory " + dir + ": " + std::strerror (errno));
+                }
+
+                // An interrupted backup of the same range continues where it stopped.
+                unsigned first = cmd.parameter(0).num();
+                unsigned last = cmd.parameter(1).num();
+                unsigned start = backupResumePoint (dir, first, last);
+                if (start != first)
+                {
+                    std::cout << "Resuming at patch " << start << "." << std::endl;
+                }
+
+                // A backup holds what the device holds now, not what the cache remembers.
+                unsigned saved = 0;
+                auto retries = midi->readStats().retriedPages;
+                bool refresh = midi->setRefresh (true);
+                try
+                {
+                    midi->retrievePatches (start, last - start + 1,
+                        [&] (unsigned patch, const std::vector<uint8_t> & patchData) {
+                            std::vector<uint8_t> d (patchData);
+                            ptch.setData (d);
+                            ptch.save (backupFileName (dir, patch));
+                            writeBackupProgress (dir, first, last, patch + 1);
+                            ++saved;
+                        });
+                }
+                catch (...)
+                {
+                    midi->setRefresh (refresh);
+                    throw;
+                }
+                midi->setRefresh (refresh);
+                // Only reached once every patch is saved, saving throws otherwise.
+                std::remove (backupProgressFileName (dir).c_str());
+                std::cout << "Saved " << saved << " patches." << std::endl;
+                if (midi->readStats().retriedPages != retries)
+                {
+                    std::cout << "Requested " << midi->readStats().retriedPages - retries << " missing or corrupt pages again." << std::endl;
+                }
+            }
+            else
+            {
+                std::cout << "Error: No MIDI ports selected." << std::endl;
+            }
+            break;
+
+        case CommandType::Restore:
+            std::cout << "=== Restore " << cmd.parameter(0).str() << " to " << cmd.parameter(1).str() << " from " << cmd.parameter(2).str() << " ===" << std::endl;
+            if (cmd.parameter(1).num() < cmd.parameter(0).num())
+            {
+                throw std::runtime_error ("Invalid patch range.");
+            }
+            if (midi)
+            {
+                std::string dir = cmd.parameter(2).str();
+                auto stats = midi->writeStats();
+                unsigned pages = midi->pacer().pages();
+                auto start = std::chrono::steady_clock::now();
+                auto results = midi->restorePatches (cmd.parameter(0).num(), cmd.parameter(1).num() - cmd.parameter(0).num() + 1,
+                    [&] (unsigned patch) {
+                        ptch.load (backupFileName (dir, patch));
+                        return ptch.data();
+                    });
+
+                unsigned failed = 0;
+                for (auto & result : results)
+                {
+                    std::cout << "Patch " << result.patch << ": " << (result.verified ? "verified" : "FAILED");
+                    if (result.attempts > 1)
+                    {
+                        std::cout << " (" << result.attempts << " attempts)";
+                    }
+                    std::cout << std::endl;
+                    failed += !result.verified;
+                }
+                // This restore only, including the read backs
+                double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+                std::cout << "Restored " << results.size() - failed << " of " << results.size() << " patches, "
+                          << (seconds > 0 ? (midi->pacer().pages() - pages) / seconds : 0) << " pages/s written." << std::endl;
+                std::cout << "Sent " << midi->writeStats().pages - stats.pages << " pages, skipped "
+                          << midi->writeStats().skipped - stats.skipped << " unchanged pages." << std::endl;
+            }
+            else
+            {
+                std::cout << "Error: No MIDI ports selected." << std::endl;
+            }
+            break;
+
+        case CommandType::List:
+            std::cout << "=== List " << cmd.parameter(0).str() << " to " << cmd.parameter(1).str() << " ===" << std::endl;
+            if (cmd.parameter(1).num() < cmd.parameter(0).num())
+            {
+                throw std::runtime_error ("Invalid patch range.");
+            }
+            if (midi)
+            {
+                // Only the pages holding the listed fields are read.
+                unsigned pages = g_fields.at (FieldId::ID_PATCH_NAME_).pageMask()
+                               | g_fields.at (FieldId::ID_PATCH_LOOP_SW_LOOP_).pageMask()
+                               | g_fields.at (FieldId::ID_PATCH_LOOP_SW_LOOP_V).pageMask();
+                midi->retrievePatches (cmd.parameter(0).num(), cmd.parameter(1).num() - cmd.parameter(0).num() + 1,
+                    [&] (unsigned patch, const std::vector<uint8_t> & patchData) {
+                        std::vector<uint8_t> d (patchData);
+                        ptch.setPartialData (d, pages);
+                        char number[8];
+                        std::snprintf (number, sizeof (number), "%3u: ", patch);
+                        std::cout << number << ptch.name() << "  " << ptch.loops() << std::endl;
+                    }, pages);
+            }
+            else
+            {
+                std::cout << "Error: No MIDI ports selected." << std::endl;
+            }
+            break;
+
         case CommandType::None:
         default:
             throw std::logic_error ("Invalid command encountered. This is a bug.");
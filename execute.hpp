@@ -6,9 +6,12 @@
 #include <vector>
 #include "commands.hpp"
 #include "commandline.hpp"
+#include "midi.hpp"
 
 ///@todo document and OOP
 
 bool validateProgram(CmdLineParameters config);
-void runProgram(CmdLineParameters config);
-void executeCommand (const Command & cmd, std::vector<uint8_t> & data, const CmdLineParameters & config);
+/** Run the commands, false if a replayed session did not match the recording. */
+bool runProgram(CmdLineParameters config);
+void runCommands (const std::list<Command> & commands, MIDI * midi);
+void executeCommand (const Command & cmd, std::vector<uint8_t> & data, MIDI * midi);
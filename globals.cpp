@@ -9,6 +9,7 @@
 #include "es8parameters.hpp"
 #include "globals.hpp"
 #include "bitcoder.hpp"
+#include "helpers.h"
 
 Globals::Globals ()
 {
@@ -20,57 +21,19 @@ void Globals::print()
     printVerbose();
 }
 
-void Globals::writeFileData(std::ostream & s)
+void Globals::writeFileData(std::string & out)
 {
-    auto dataCopy = data();
-    BitDecoder bc (dataCopy);
-
-    for (auto it = g_fields.begin(); it != g_fields.end(); ++it)
-    {
-        if (it->second.type() == Field::Globals)
-        {
-            for (auto i = 0; i < it->second.numFields(); ++i)
-            {
-		if (it->second.numFields() == 1)
-                {
-                    s << it->second.id() << ": " << it->second.value (bc.getValue(it->second.bitOffset(i), it->second.bitLength())) << std::endl;
-                }
-                else
-                {
-                    s << it->second.id() << "" << (i+1) << ": " << it->second.value (bc.getValue(it->second.bitOffset(i), it->second.bitLength()));
-                    if (it->second.id() == "ID_PATCH_NAME_")
-                    {
-                        s << " '" << char(bc.getValue(it->second.bitOffset(i), it->second.bitLength())) << "'";
-                    }
-                    s << std::endl;
-                }
-            }
-        }
-    }
+    writeValues (out, Field::Globals);
 }
 
 void Globals::load(std::string filename)
 {
-    std::ifstream infile (filename);
-    
-    std::string line;
-    std::getline(infile, line);
-    if (line != "ES8cli globals file format 1")
-    {
-        std::cerr << "wrong file format <" << line << ">" << std::endl;
-        throw std::runtime_error ("Wrong globals file format");
-    }
-
-    loadValues (infile);
+    loadValues (loadFile (filename), "ES8cli globals file format 1", "Wrong globals file format");
 }
 
 void Globals::save(std::string filename)
 {
-    std::ofstream backupFile;
-    backupFile.open ("globals.es8");
-    backupFile << "ES8cli globals file format 1" << std::endl;
-    writeFileData(backupFile);
-    backupFile.close();
+    saveValues ("globals.es8", "ES8cli globals file format 1");
 }
 
 bool Globals::dataValid(std::vector<uint8_t> & data)
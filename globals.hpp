@@ -16,7 +16,7 @@ class Globals : public ES8Data
         void save(std::string filename) override;
 
     protected:
-        void writeFileData (std::ostream & s) override;
+        void writeFileData (std::string & out) override;
         bool dataValid(std::vector<uint8_t> & data) override;
 };
 
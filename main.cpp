@@ -14,10 +14,14 @@
 #include "globals.hpp"
 #include "bitcoder.hpp"
 #include "es8parameters.hpp"
+#include "decodeddata.hpp"
+#include "patchfields.hpp"
 
 #include "midi.hpp"
+#include "emulator.hpp"
 #include "helpers.h"
 #include "test.hpp"
+#include "benchmark.hpp"
 #include "commands.hpp"
 #include "commandline.hpp"
 #include "execute.hpp"
@@ -40,18 +44,25 @@ void printHelp()
     std::cout << std::endl;
     std::cout << "  --help:         Show this help text" << std::endl;
     std::cout << "  --list-midi:    List MIDI input and output devices" << std::endl;
+    std::cout << "  --emulate:      Emulate an ES-8 on virtual MIDI ports for testing (honors --midi-baud)" << std::endl;
     std::cout << std::endl;
     std::cout << "Options:" << std::endl << std::endl;
     std::cout << "  --verbose:      Output more information" << std::endl;
     std::cout << std::endl;
     std::cout << "  --midi-in <N>:  Index of the MIDI input port to use" << std::endl;
     std::cout << "  --midi-out <N>: Index of the MIDI output port to use" << std::endl;
+    std::cout << "  --midi-baud <N>: Limit writes to the baud rate of the MIDI link (31250 for DIN, default: no limit)" << std::endl;
+    std::cout << "  --record <file>: Record all MIDI messages of the session into a file" << std::endl;
+    std::cout << "  --replay <file>: Replay a recorded session instead of using MIDI ports, fails if the sent messages differ" << std::endl;
+    std::cout << "  --rawmidi <dev>: Use an ALSA raw MIDI device (e.g. hw:1,0,0, see amidi -l) instead of MIDI ports, Linux only" << std::endl;
+    std::cout << "  --cache <file>: Keep patches read from the ES-8 in a file and read them from there in later runs (backup always reads the ES-8)" << std::endl;
+    std::cout << "  --refresh:      Read all patches from the ES-8 again and update the cache" << std::endl;
     std::cout << std::endl;
 
     std::cout << "Commands:" << std::endl << std::endl;
     std::cout << "  select [patch|filename]:                          Select a patch from the ES-8 or a file" << std::endl;
     std::cout << "  copy [patch|filename] [patch|filename]:           Copy a patch from one location to another (the ES-8 or a file)" << std::endl;
-    std::cout << "  store [patch|filename]:                           Store the currently used patch to the ES-8 or a file" << std::endl;
+    std::cout << "  store [patch|filename]:                           Store the currently used patch to the ES-8 (unchanged pages are skipped) or a file" << std::endl;
     std::cout << "  view [patch|filename]:                            View information about a patch from the ES-8 or a file" << std::endl;
     std::cout << "  display:                                          View information about the currently used patch" << std::endl;
     std::cout << "  name [patch name]:                                Set the name of the patch (32 characters max.)" << std::endl;
@@ -61,6 +72,9 @@ void printHelp()
     std::cout << "  patchmidichannel [index] [channel|OFF]:           Set the MIDI channel for a patch MIDI setting" << std::endl;
     std::cout << "  patchmidipc [index] [PC|OFF]:                     Set the program change for a patch MIDI setting" << std::endl;
     std::cout << "  patchmidicc [index] [Ctl-index] [CC|OFF] [value]: Set a CC for a patch MIDI setting " << std::endl;
+    std::cout << "  backup [first] [last] [directory]:                Save patches first to last from the ES-8 into a directory (an interrupted backup resumes)" << std::endl;
+    std::cout << "  restore [first] [last] [directory]:               Write patches first to last from a backup directory to the ES-8 and verify them" << std::endl;
+    std::cout << "  list [first] [last]:                              List names and loops of patches first to last on the ES-8" << std::endl;
     std::cout << std::endl;
 
     std::cout << "Examples:" << std::endl << std::endl;
@@ -74,6 +88,18 @@ void printHelp()
     std::cout << "  Backup a patch:" << std::endl;
     std::cout << "    copy 44 mybackup.es8" << std::endl;
     std::cout << "" << std::endl;
+    std::cout << "  Backup all patches into the directory mybackup:" << std::endl;
+    std::cout << "    backup 0 799 mybackup" << std::endl;
+    std::cout << "" << std::endl;
+    std::cout << "  List the names of all patches:" << std::endl;
+    std::cout << "    list 0 799" << std::endl;
+    std::cout << "" << std::endl;
+    std::cout << "  Show patch 44, reading it from the ES-8 only if it is not in the cache file es8.cache yet:" << std::endl;
+    std::cout << "    --cache es8.cache view 44" << std::endl;
+    std::cout << "" << std::endl;
+    std::cout << "  Restore all patches from the directory mybackup over a DIN MIDI cable:" << std::endl;
+    std::cout << "    --midi-baud 31250 restore 0 799 mybackup" << std::endl;
+    std::cout << "" << std::endl;
     std::cout << "  Restore a patch:" << std::endl;
     std::cout << "    copy mybackup.es8 44 " << std::endl;
     std::cout << "" << std::endl;
@@ -86,6 +112,9 @@ void printHelp()
     std::cout << "  Load a patch from a file and store it to two different patches with differnt loops activated:" << std::endl;
     std::cout << "    select mybackup.es8 loops 146 store 44 loops 148V store 45" << std::endl;
     std::cout << "" << std::endl;
+    std::cout << "  Create two patches from the template in patch 799 in one run, the template is read from the ES-8 only once:" << std::endl;
+    std::cout << "    select 799 name \"Clean\" store 1 select 799 name \"Fuzz\" loops 24V store 2" << std::endl;
+    std::cout << "" << std::endl;
     std::cout << "  Send a program change and CC on MIDI channel 5 when activating a patch:" << std::endl;
     std::cout << "    select 44 patchmidichannel 1 5 patchmidipc 1 23 patchmidicc 1 1 85 127 store 44" << std::endl;
     std::cout << "" << std::endl;
@@ -132,14 +161,42 @@ int main(int argc, char *argv[])
                 return 0;
     
             case CmdLineParameters::SelfTest:
-                testSystemStruct();
-                testStruct();
+                testBitDecoder();
+                testBitCodec();
+                testDecodedData();
+                testPatchFields();
+                testFieldRegistry();
+                testSysExQueue();
+                testSysExFramer();
+                testUnscramblePage();
+                testPageFramer();
+                testWritePacer();
+                testReadPlanner();
+                testTransport();
+                testEmulator();
+                testPageCache();
+                testProgramPlan();
+                testBackup();
+                return 0;
+
+            case CmdLineParameters::Benchmark:
+                runBenchmarks();
+                return 0;
+
+            case CmdLineParameters::Emulate:
+                {
+                    Emulator emulator;
+                    emulator.serveVirtualPorts ("ES-8 emulator", cmd.midibaud / 10);
+                }
                 return 0;
     
             case CmdLineParameters::Run:
                 if (validateProgram(cmd))
                 {
-                    runProgram(cmd);
+                    if (!runProgram(cmd))
+                    {
+                        return 1;
+                    }
                 }
                 else
                 {
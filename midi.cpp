@@ -5,29 +5,203 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <deque>
 #include "rtmidi-4.0.0/RtMidi.h"
 #include "midi.hpp"
+#include "sysexqueue.hpp"
+#include "pageframer.hpp"
+#include "writepacer.hpp"
+#include "miditransport.hpp"
+#include "pagecache.hpp"
 
 #include "helpers.h"
 
-///@todo use unique_ptr<>
-
 #include "midimessages.hpp"
 
-std::vector<uint8_t> waitForMessage(RtMidiIn * midiin, const std::vector<uint8_t> & expect, const std::vector<uint8_t> & expectMask);
+/** Times a read is asked again before giving up. */
+static const unsigned maxReadRetries = 4;
+
+/** Pause before the first retry of a read, doubled for each further one. */
+static const std::chrono::milliseconds retryBackoff (20);
+
+/** Pages on the wire at most, so they all fit into the receive queue. */
+static const unsigned readWindow = SysExQueue::capacity / 2;
+
+/** Most pages per planned request, so that several of them fit into the window together. */
+static const unsigned maxPlannedPages = readWindow / 4;
+
+/** Pages of the system area, the device sends all of them for a request of page 0. */
+static const unsigned systemPages = 16;
+
+/** Time per page until measured, as over DIN where fetching pages along hurts most. */
+static const std::chrono::microseconds defaultPageCost (PageFramer::pageSize * 10 * 1000000 / 31250);
+
+/** True for a message that starts like a DT1 page from a Roland device. */
+static bool isDataSet (const std::vector<uint8_t> & message)
+{
+    return message.size() >= 8 && message[0] == 0xf0 && message[1] == 0x41 && message[7] == 0x12;
+}
+
+/** True if message matches expect in all bits set in expectMask. */
+static bool matches (const std::vector<uint8_t> & message, const std::vector<uint8_t> & expect, const std::vector<uint8_t> & expectMask)
+{
+    if (message.size() < expectMask.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < expectMask.size(); ++i)
+    {
+        if ((message[i] & expectMask[i]) != (expect[i] & expectMask[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+MIDI::MIDI (unsigned devin, unsigned devout, unsigned bytesPerSecond) : MIDI (std::unique_ptr<MidiTransport> (new RtMidiTransport (devin, devout)), bytesPerSecond)
+{
+}
+
+MIDI::MIDI (std::unique_ptr<MidiTransport> transport, unsigned bytesPerSecond) : m_pacer (bytesPerSecond), m_readCosts {std::chrono::milliseconds (1), bytesPerSecond ? std::chrono::microseconds (PageFramer::pageSize * 1000000 / bytesPerSecond) : defaultPageCost}, m_measureCosts (true), m_pageCostMeasured (false), m_readTimeout (1000), m_queue (new SysExQueue), m_transport (std::move (transport)), m_framer (new PageFramer), m_cache (nullptr), m_refresh (false), m_reuseKnown (false), m_open (false)
+{
+    // A DT1 page is 155 bytes
+    m_received.reserve (256);
+}
+
+MIDI::~MIDI ()
+{
+}
+
+const std::vector<uint8_t> & MIDI::identity ()
+{
+    connect();
+    return m_identity;
+}
+
+std::vector<uint8_t> MIDI::requestIdentity ()
+{
+    //std::cout << "Request device ID" << std::endl;
+    RequestIdMessage reqID;
+    auto message = reqID.getMessageData();
+    m_transport->send(message);
+
+    //std::cout << "Wait for device ID" << std::endl;
+    std::vector<uint8_t> expect;
+    std::vector<uint8_t> expectMask;
+    expect.push_back (0xf0); expectMask.push_back (0xff);
+    expect.push_back (0x7e); expectMask.push_back (0xff);
+    expect.push_back (0x00); expectMask.push_back (0x00);
+    expect.push_back (0x06); expectMask.push_back (0xff);
+    expect.push_back (0x02); expectMask.push_back (0xff);
+    expect.push_back (0x41); expectMask.push_back (0xff);
+    expect.push_back (0x14); expectMask.push_back (0xff);
+    expect.push_back (0x03); expectMask.push_back (0xff);
+
+    auto result = waitForMessage (expect, expectMask);
+
+    if (result.size() == 0)
+    {
+        throw std::runtime_error ("Could not communicate with ES-8");
+    }
+    return result;
+}
+
+void MIDI::ping ()
+{
+    connect();
+    auto start = std::chrono::steady_clock::now();
+    requestIdentity();
+    m_pacer.adapt (std::chrono::steady_clock::now() - start);
+}
+
+const WritePacer & MIDI::pacer () const
+{
+    return m_pacer;
+}
+
+const MIDI::ReadStats & MIDI::readStats () const
+{
+    return m_readStats;
+}
 
-MIDI::MIDI (unsigned devin, unsigned devout) : m_devIn (devin), m_devOut (devout)
+const MIDI::ReadCosts & MIDI::readCosts () const
 {
+    return m_readCosts;
 }
 
+void MIDI::setReadCosts (const ReadCosts & costs)
+{
+    m_readCosts = costs;
+    m_measureCosts = false;
+}
+
+void MIDI::setCache (PageCache * cache, bool refresh)
+{
+    m_cache = cache;
+    m_refresh = refresh;
+    if (m_cache && !m_identity.empty())
+    {
+        m_cache->setDevice (m_identity);
+    }
+}
+
+bool MIDI::setRefresh (bool refresh)
+{
+    std::swap (m_refresh, refresh);
+    return refresh;
+}
+
+const MIDI::WriteStats & MIDI::writeStats () const
+{
+    return m_writeStats;
+}
+
+void MIDI::setReadTimeout (std::chrono::milliseconds timeout)
+{
+    m_readTimeout = timeout;
+}
+
+void MIDI::connect ()
+{
+    using namespace std::chrono_literals;
+
+    if (!m_identity.empty())
+    {
+        return;
+    }
+
+    if (!m_open)
+    {
+        SysExQueue * queue = m_queue.get();
+        m_transport->open ([queue] (const uint8_t * data, size_t size) { queue->push (data, size); });
+        m_open = true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = requestIdentity();
+    auto roundTrip = std::chrono::steady_clock::now() - start;
+    m_pacer.setIdleRoundTrip (roundTrip);
+    if (m_measureCosts)
+    {
+        m_readCosts.request = std::chrono::duration_cast<std::chrono::microseconds> (roundTrip);
+    }
+    std::this_thread::sleep_for(2ms);
+
+    m_identity = result;
+    if (m_cache)
+    {
+        m_cache->setDevice (m_identity);
+    }
+}
 
 std::string MIDI::midiInName(unsigned i)
 {
-    RtMidiIn  *midiin = 0;
     try 
     {
-        midiin = new RtMidiIn(RtMidi::UNSPECIFIED, "ES8cli", 2000);
-        return midiin->getPortName(i-1);
+        RtMidiIn midiin (RtMidi::UNSPECIFIED, "ES8cli", 2000);
+        return midiin.getPortName(i-1);
     }
     catch (const RtMidiError &error)
     {
@@ -38,11 +212,10 @@ std::string MIDI::midiInName(unsigned i)
 
 std::string MIDI::midiOutName(unsigned i)
 {
-    RtMidiOut  *midiOut = 0;
     try 
     {
-        midiOut = new RtMidiOut();
-        return midiOut->getPortName(i-1);
+        RtMidiOut midiOut;
+        return midiOut.getPortName(i-1);
     }
     catch (const RtMidiError &error)
     {
@@ -54,11 +227,11 @@ std::string MIDI::midiOutName(unsigned i)
 int MIDI::listMidiDevices()
 {
     int result = 0;
-    RtMidiIn  *midiin = 0;
-    RtMidiOut *midiout = 0;
+    std::unique_ptr<RtMidiIn> midiin;
+    std::unique_ptr<RtMidiOut> midiout;
     try 
     {
-        midiin = new RtMidiIn(RtMidi::UNSPECIFIED, "ES8cli", 2000);
+        midiin.reset (new RtMidiIn(RtMidi::UNSPECIFIED, "ES8cli", 2000));
         unsigned int nPorts = midiin->getPortCount();
         if (nPorts == 1)
         {
@@ -75,7 +248,7 @@ int MIDI::listMidiDevices()
             std::cout << "  " << i+1 << ": " << portName << std::endl;
         }
         std::cout << std::endl;
-        midiout = new RtMidiOut();
+        midiout.reset (new RtMidiOut());
         nPorts = midiout->getPortCount();
         if (nPorts == 1)
         {
@@ -98,287 +271,747 @@ int MIDI::listMidiDevices()
         result = EXIT_FAILURE;
     }
 
-    delete midiin;
-    delete midiout;
     return result;
 }
 
-std::vector<uint8_t> waitForMessage(RtMidiIn * midiin, const std::vector<uint8_t> & expect, const std::vector<uint8_t> & expectMask)
+std::vector<uint8_t> MIDI::waitForMessage (const std::vector<uint8_t> & expect, const std::vector<uint8_t> & expectMask)
 {
-    using namespace std::chrono_literals;
-    std::vector<uint8_t> result;
-    bool found = false;
-    unsigned timeout = 1000;
-
-    while(!found && timeout > 0)
-    {
-        std::vector<uint8_t> message;
-        double stamp = midiin->getMessage(&message);
-        int nBytes = message.size();
-	if (nBytes >= expectMask.size())
-        {   
-            found = true;
-            for (auto i = 0; i < expectMask.size(); ++i)
-            {
-                found &= (message[i] & expectMask[i]) == (expect[i] & expectMask[i]);
-            }
-            if (found)
-            {
-                result = message;
-            }
+    for (auto it = m_messages.begin(); it != m_messages.end(); ++it)
+    {
+        if (matches (*it, expect, expectMask))
+        {
+            auto message = std::move (*it);
+            m_messages.erase (it);
+            return message;
         }
-        else
+    }
+
+    auto deadline = SysExQueue::Clock::now() + m_readTimeout;
+
+    while (m_queue->pop (m_received, deadline))
+    {
+        if (matches (m_received, expect, expectMask))
+        {
+            return m_received;
+        }
+        if (isDataSet (m_received))
         {
-            std::this_thread::sleep_for(1ms);
-            timeout--;
+            m_framer->feed (m_received.data(), m_received.size());
         }
     }
 
-    return result;
+    return std::vector<uint8_t>();
 }
 
-void MIDI::sendPatch (unsigned patch, std::vector<uint8_t> data)
+bool MIDI::dispatchMessage (Clock::time_point deadline)
 {
-    using namespace std::chrono_literals;
+    // Messages nobody waits for, e.g. late identity replies, only need to be kept for a while.
+    const size_t keepMessages = 16;
 
-    data = scrambleData(data);
+    if (!m_queue->pop (m_received, deadline))
+    {
+        return false;
+    }
 
-    WritePageMessage wpm1 (14 + 2*patch, std::vector<uint8_t> (&data[0], &data[155]));
-    WritePageMessage wpm2 (14 + 2*patch + 1, std::vector<uint8_t> (&data[155], &data[2*155]));
+    if (isDataSet (m_received))
+    {
+        m_framer->feed (m_received.data(), m_received.size());
+    }
+    else
+    {
+        if (m_messages.size() == keepMessages)
+        {
+            m_messages.pop_front();
+        }
+        m_messages.push_back (m_received);
+    }
+    return true;
+}
 
-    RtMidiOut *midiout = 0;
-    RtMidiIn *midiin = 0;
+std::list<MIDI::PendingRead>::iterator MIDI::submitRead (unsigned first, unsigned count)
+{
+    PendingRead read;
+    read.first = first;
+    read.count = count;
+    read.state.assign (count, 0);
+    read.received = 0;
+    read.corrupt = 0;
+    read.data.assign (count * PageFramer::dataSize, 0);
+    read.sent = false;
+    read.retries = 0;
+    read.current = true;
+    read.mayFail = false;
+    read.failed = false;
+    auto it = m_reads.insert (m_reads.end(), std::move (read));
 
-    try 
+    it->route = m_framer->route (first, count, [this, it] (unsigned page, const uint8_t * data, bool valid) {
+        unsigned i = page - it->first;
+        unsigned received = it->received;
+        if (received == 0)
+        {
+            it->firstPage = Clock::now();
+        }
+
+        if (it->state[i] == 1)
+        {
+            // Requested twice, the first copy was fine
+        }
+        else if (valid)
+        {
+            it->received += it->state[i] == 0;
+            it->corrupt -= it->state[i] == 2;
+            it->state[i] = 1;
+            std::copy (data, data + PageFramer::dataSize, &it->data[i * PageFramer::dataSize]);
+            if (it->current)
+            {
+                m_knownPages[page].assign (data, data + PageFramer::dataSize);
+                if (m_cache)
+                {
+                    m_cache->store (page, data);
+                }
+            }
+        }
+        else if (it->state[i] == 0)
+        {
+            ++it->received;
+            ++it->corrupt;
+            it->state[i] = 2;
+        }
+
+        // The pages of a read stream in back to back at the cost of a page
+        if (m_measureCosts && received < it->count && it->received == it->count && it->retries == 0 && it->count >= 2)
+        {
+            auto perPage = std::chrono::duration_cast<std::chrono::microseconds> ((Clock::now() - it->firstPage) / (it->count - 1));
+            m_readCosts.page = m_pageCostMeasured ? (3 * m_readCosts.page + perPage) / 4 : perPage;
+            m_pageCostMeasured = true;
+        }
+
+        // The device answers in order, so reads sent after this one have
+        // not been waiting yet. Reads sent before it and still missing
+        // pages keep their deadline and are sent again when it passes.
+        auto now = Clock::now();
+        for (auto later = it; later != m_reads.end(); ++later)
+        {
+            later->deadline = std::max (later->deadline, now + m_readTimeout);
+        }
+    });
+    return it;
+}
+
+std::vector<std::list<MIDI::PendingRead>::iterator> MIDI::submitReads (const std::vector<unsigned> & pages)
+{
+    // Pages known from earlier in the session or from the cache need no
+    // request. Cached pages are not known contents of the device, the
+    // device may have been edited since, so writes never skip them.
+    auto known = [this] (unsigned page) -> const std::vector<uint8_t> * {
+        auto it = m_knownPages.find (page);
+        return m_reuseKnown && it != m_knownPages.end() ? &it->second : nullptr;
+    };
+    auto stored = [&] (unsigned page) {
+        auto data = known (page);
+        return data || !m_cache || m_refresh ? data : m_cache->page (page);
+    };
+
+    std::vector<std::list<PendingRead>::iterator> reads;
+    std::vector<unsigned> cached;
+    std::vector<unsigned> uncached;
+    for (auto page : pages)
     {
-        midiout = new RtMidiOut();
-        midiin = new RtMidiIn(RtMidi::UNSPECIFIED, "ES8cli", 2000);
+        (stored (page) ? cached : uncached).push_back (page);
     }
-    catch (const RtMidiError &error) 
+
+    std::sort (cached.begin(), cached.end());
+    cached.erase (std::unique (cached.begin(), cached.end()), cached.end());
+    for (size_t i = 0; i < cached.size(); )
     {
-        error.printMessage();
-        throw std::runtime_error ("Could not open MIDI ports");
+        size_t start = i++;
+        while (i < cached.size() && cached[i] == cached[i - 1] + 1)
+        {
+            ++i;
+        }
+
+        auto read = submitRead (cached[start], unsigned (i - start));
+        for (size_t j = start; j < i; ++j)
+        {
+            if (known (cached[j]))
+            {
+                ++m_readStats.reused;
+            }
+            else
+            {
+                ++m_readStats.cached;
+            }
+            auto data = stored (cached[j]);
+            std::copy (data->begin(), data->end(), read->data.begin() + (j - start) * PageFramer::dataSize);
+        }
+        read->state.assign (read->count, 1);
+        read->received = read->count;
+        read->sent = true;
+        reads.push_back (read);
     }
 
-    midiout->openPort(m_devOut-1);
-    midiin->openPort(m_devIn-1);
+    for (auto & range : planReads (uncached))
+    {
+        reads.push_back (submitRead (range.first, range.count));
+    }
+    return reads;
+}
 
-    midiin->ignoreTypes(false, true, true);
+std::vector<PageRange> MIDI::planReads (const std::vector<unsigned> & pages) const
+{
+    return planPageRanges (pages, double (m_readCosts.request.count()), double (m_readCosts.page.count()), maxPlannedPages);
+}
 
-    //std::cout << "Request device ID" << std::endl;
-    RequestIdMessage reqID;
-    auto message = reqID.getMessageData();
-    midiout->sendMessage(&message);
+void MIDI::sendReads ()
+{
+    unsigned onWire = 0;
+    for (auto & read : m_reads)
+    {
+        if (read.failed)
+        {
+            // Given up, late pages are ignored
+        }
+        else if (read.sent)
+        {
+            onWire += read.count - read.received;
+        }
+        else if (onWire == 0 || onWire + read.count <= readWindow)
+        {
+            requestPages (read.first, read.count);
+            read.sent = true;
+            read.deadline = Clock::now() + m_readTimeout;
+            onWire += read.count;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
 
-    //std::cout << "Wait for device ID" << std::endl;
-    std::vector<uint8_t> expect;
-    std::vector<uint8_t> expectMask;
-    expectMask.clear();
-    expect.push_back (0xf0); expectMask.push_back (0xff);
-    expect.push_back (0x7e); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0x00);
-    expect.push_back (0x06); expectMask.push_back (0xff);
-    expect.push_back (0x02); expectMask.push_back (0xff);
-    expect.push_back (0x41); expectMask.push_back (0xff);
-    expect.push_back (0x14); expectMask.push_back (0xff);
-    expect.push_back (0x03); expectMask.push_back (0xff);
+void MIDI::awaitRead (std::list<PendingRead>::iterator read)
+{
+    sendReads();
+    while (!read->failed && (read->received < read->count || read->corrupt > 0))
+    {
+        // Reads with all pages in, but some of them corrupt, are asked again right away
+        auto deadline = Clock::time_point::max();
+        for (auto & r : m_reads)
+        {
+            if (r.failed)
+            {
+                continue;
+            }
+            if (r.sent && r.received == r.count && r.corrupt > 0)
+            {
+                retryRead (r);
+            }
+            if (r.sent && r.received < r.count)
+            {
+                deadline = std::min (deadline, r.deadline);
+            }
+        }
 
-    auto result = waitForMessage (midiin, expect, expectMask);
+        if (dispatchMessage (deadline))
+        {
+            sendReads();
+            continue;
+        }
 
-    if (result.size() == 0)
+        auto now = Clock::now();
+        for (auto & r : m_reads)
+        {
+            if (!r.failed && r.sent && r.received < r.count && r.deadline <= now)
+            {
+                retryRead (r);
+            }
+        }
+    }
+}
+
+void MIDI::retryRead (PendingRead & read)
+{
+    if (read.retries == maxReadRetries)
     {
-        throw std::runtime_error ("Could not communicate with ES-8");
+        if (read.mayFail)
+        {
+            read.failed = true;
+            return;
+        }
+        throw std::runtime_error (read.received < read.count ? "Could not communicate with ES-8" : "MIDI data checksum failed");
     }
-    std::this_thread::sleep_for(2ms);
+    std::this_thread::sleep_for (retryBackoff * (1 << read.retries));
+    ++read.retries;
+    ++m_readStats.retries;
 
-    auto d1 = wpm1.getMessageData();
-    writeFile ("debug_midimessage_1.bin", d1);
-    midiout->sendMessage(&d1);
-    std::this_thread::sleep_for(2ms);
+    // The pages that are not intact, intact ones in between may come along
+    std::vector<unsigned> pages;
+    for (unsigned i = 0; i < read.count; ++i)
+    {
+        if (read.state[i] == 2)
+        {
+            read.state[i] = 0;
+            --read.received;
+            --read.corrupt;
+        }
+        if (read.state[i] != 1)
+        {
+            pages.push_back (read.first + i);
+        }
+    }
+    if (read.first == 0)
+    {
+        // Single pages of the system area cannot be requested
+        requestPages (0, read.count);
+        m_readStats.retriedPages += read.count;
+    }
+    else
+    {
+        for (auto & range : planReads (pages))
+        {
+            requestPages (range.first, range.count);
+            m_readStats.retriedPages += range.count;
+        }
+    }
+    read.deadline = Clock::now() + m_readTimeout;
+}
 
-    auto d2 = wpm2.getMessageData();
-    writeFile ("debug_midimessage_1.bin", d2);
-    midiout->sendMessage(&d2);
+void MIDI::dropRead (std::list<PendingRead>::iterator read)
+{
+    m_framer->unroute (read->route);
+    m_reads.erase (read);
 }
 
-std::vector<uint8_t> MIDI::retrievePatch (unsigned patch, unsigned count)
+void MIDI::prefetchPatches (const std::vector<unsigned> & patches)
 {
-    //std::cout << std::endl << "Retrieve patch " << patch << std::endl;
-    using namespace std::chrono_literals;
-    
-    RtMidiOut *midiout = 0;
-    RtMidiIn *midiin = 0;
-    std::vector<uint8_t> expect;
-    std::vector<uint8_t> expectMask;
-    std::vector<uint8_t> result;
+    connect();
 
-    try 
+    std::vector<unsigned> pages;
+    for (auto patch : patches)
     {
-        midiout = new RtMidiOut();
-        midiin = new RtMidiIn(RtMidi::UNSPECIFIED, "ES8cli", 2000);
+        pages.push_back (14 + 2 * patch);
+        pages.push_back (14 + 2 * patch + 1);
     }
-    catch (const RtMidiError &error) 
+
+    // A patch may be spread over two reads, both keep it until it is handed out
+    for (auto read : submitReads (pages))
     {
-        error.printMessage();
-        throw std::runtime_error ("Could not open MIDI ports");
+        for (auto patch : patches)
+        {
+            unsigned page = 14 + 2 * patch;
+            if (page < read->first + read->count && page + 2 > read->first)
+            {
+                read->patches.push_back (patch);
+            }
+        }
     }
+    sendReads();
+}
 
-    midiout->openPort(m_devOut-1);
-    midiin->openPort(m_devIn-1);
+void MIDI::sendPatch (unsigned patch, std::vector<uint8_t> data)
+{
+    connect();
 
-    midiin->ignoreTypes(false, true, true);
+    auto scrambled = scrambleData(data);
+    for (unsigned i = 0; i < 2; ++i)
+    {
+        unsigned page = 14 + 2*patch + i;
+        std::vector<uint8_t> pageData (&data[i * PageFramer::dataSize], &data[(i + 1) * PageFramer::dataSize]);
 
-    //std::cout << "Request device ID" << std::endl;
-    RequestIdMessage reqID;
-    auto message = reqID.getMessageData();
-    midiout->sendMessage(&message);
+        auto known = m_knownPages.find (page);
+        if (known != m_knownPages.end() && known->second == pageData)
+        {
+            ++m_writeStats.skipped;
+            continue;
+        }
 
-    //std::cout << "Wait for device ID" << std::endl;
-    expect.clear();
-    expectMask.clear();
-    expect.push_back (0xf0); expectMask.push_back (0xff);
-    expect.push_back (0x7e); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0x00);
-    expect.push_back (0x06); expectMask.push_back (0xff);
-    expect.push_back (0x02); expectMask.push_back (0xff);
-    expect.push_back (0x41); expectMask.push_back (0xff);
-    expect.push_back (0x14); expectMask.push_back (0xff);
-    expect.push_back (0x03); expectMask.push_back (0xff);
-    result = waitForMessage (midiin, expect, expectMask);
+        if (m_cache)
+        {
+            m_cache->invalidate (page);
+        }
 
-    if (result.size() == 0)
+        // Reads on the wire may still bring the old contents of the page
+        for (auto & r : m_reads)
+        {
+            if (r.sent && page - r.first < r.count)
+            {
+                r.current = false;
+            }
+        }
+
+        WritePageMessage wpm (page, std::vector<uint8_t> (&scrambled[i * 155], &scrambled[(i + 1) * 155]));
+        auto d = wpm.getMessageData();
+        m_pacer.wait (d.size());
+        m_transport->send(d);
+        ++m_writeStats.pages;
+        m_knownPages[page] = std::move (pageData);
+    }
+}
+
+void MIDI::reuseKnownPages (bool reuse)
+{
+    m_reuseKnown = reuse;
+}
+
+void MIDI::confirmWrites ()
+{
+    ping();
+}
+
+void MIDI::setKnownPatch (unsigned patch, const std::vector<uint8_t> & data)
+{
+    for (unsigned i = 0; i < 2; ++i)
     {
-        throw std::runtime_error ("Could not communicate with ES-8");
+        m_knownPages[14 + 2*patch + i].assign (&data[i * PageFramer::dataSize], &data[(i + 1) * PageFramer::dataSize]);
     }
+}
 
-    std::this_thread::sleep_for(2ms);
+void MIDI::clearKnownPatches ()
+{
+    m_knownPages.clear();
+}
 
-    //std::cout << "Request patch" << std::endl;
-    RequestDataMessage reqDat(14 + 2 * patch, 2*count);
-    message = reqDat.getMessageData();
-    midiout->sendMessage(&message);
+void MIDI::sendPatches (unsigned first, unsigned count, const PatchSource & source)
+{
+    // Patches between identity pings that adapt the pacing.
+    const unsigned pingInterval = 8;
 
-    //std::cout << "Wait for patch" << std::endl;
-    expect.clear();
-    expectMask.clear();
-    expect.push_back (0xf0); expectMask.push_back (0xff);
-    expect.push_back (0x41); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0x00);
-    expect.push_back (0x00); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0xff);
-    expect.push_back (0x14); expectMask.push_back (0xff);
-    expect.push_back (0x12); expectMask.push_back (0xff);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        sendPatch (first + i, source (first + i));
+        if ((i + 1) % pingInterval == 0)
+        {
+            ping();
+        }
+    }
 
-    result = waitForMessage (midiin, expect, expectMask);
+    // The reply also confirms that the device has taken all pages.
+    ping();
+}
 
-    if (result.size() == 0)
+std::vector<uint8_t> MIDI::retrievePatch (unsigned patch, unsigned count)
+{
+    connect();
+
+    unsigned page = 14 + 2 * patch;
+    std::vector<std::list<PendingRead>::iterator> reads;
+    if (count == 1)
     {
-        throw std::runtime_error ("Could not communicate with ES-8");
+        for (auto read = m_reads.begin(); read != m_reads.end(); ++read)
+        {
+            auto prefetched = std::find (read->patches.begin(), read->patches.end(), patch);
+            if (prefetched != read->patches.end())
+            {
+                read->patches.erase (prefetched);
+                reads.push_back (read);
+            }
+        }
+    }
+    if (reads.empty())
+    {
+        std::vector<unsigned> pages;
+        for (unsigned i = 0; i < 2 * count; ++i)
+        {
+            pages.push_back (page + i);
+        }
+        reads = submitReads (pages);
     }
 
-    for (auto i = 0; i < 2 * (count) - 1; ++i) 
+    std::vector<uint8_t> state (2 * count, 0);
+    std::vector<uint8_t> result (2 * count * PageFramer::dataSize, 0);
+    try
+    {
+        for (auto read : reads)
+        {
+            awaitRead (read);
+            unsigned from = std::max (page, read->first);
+            unsigned to = std::min (page + 2 * count, read->first + read->count);
+            for (unsigned p = from; p < to; ++p)
+            {
+                state[p - page] = read->state[p - read->first];
+                auto data = read->data.begin() + (p - read->first) * PageFramer::dataSize;
+                std::copy (data, data + PageFramer::dataSize, result.begin() + (p - page) * PageFramer::dataSize);
+            }
+        }
+    }
+    catch (...)
     {
-        auto result2 = waitForMessage (midiin, expect, expectMask);
-        if (result2.size() == 0)
+        for (auto read : reads)
         {
-            throw std::runtime_error ("Could not communicate with ES-8");
+            dropRead (read);
         }
+        throw;
+    }
 
+    // Prefetched reads stay until all their patches are handed out
+    for (auto read : reads)
+    {
+        if (read->patches.empty())
+        {
+            dropRead (read);
+        }
+    }
 
-        result.insert(result.end(), result2.begin(), result2.end());
+    for (auto s : state)
+    {
+        if (s != 1)
+        {
+            throw std::runtime_error ("MIDI data checksum failed");
+        }
     }
-    writeFile ("debug_incoming.bin", result);
-    result = unscrambleData (result);
     return result;
 }
 
-std::vector<uint8_t> MIDI::retrieveSystem ()
+void MIDI::requestPages (unsigned page, unsigned count)
 {
-    //std::cout << std::endl << "Retrieve system pages" << std::endl;
-    using namespace std::chrono_literals;
-    
-    RtMidiOut *midiout = 0;
-    RtMidiIn *midiin = 0;
-    std::vector<uint8_t> expect;
-    std::vector<uint8_t> expectMask;
-    std::vector<uint8_t> result;
+    RequestDataMessage reqDat(page, count);
+    auto message = reqDat.getMessageData();
+    m_transport->send(message);
+    ++m_readStats.requests;
+    m_readStats.pages += count;
+}
 
-    try 
+void MIDI::retrievePatches (unsigned first, unsigned count, const PatchSink & sink, unsigned pages)
+{
+    // Patches per chunk, two chunks fit into the window of sendReads()
+    const unsigned chunk = SysExQueue::capacity / 8;
+    const size_t patchSize = 2 * PageFramer::dataSize;
+
+    if (pages == 0 || pages > 3)
     {
-        midiout = new RtMidiOut();
-        midiin = new RtMidiIn(RtMidi::UNSPECIFIED, "ES8cli", 2000);
+        throw std::logic_error ("Invalid patch pages");
     }
-    catch (const RtMidiError &error) 
+
+    connect();
+
+    /** Patches of one chunk and the reads that fetch them. */
+    struct Chunk
     {
-        error.printMessage();
-        throw std::runtime_error ("Could not open MIDI ports");
-    }
+        unsigned first;
+        unsigned count;
+        std::vector<std::list<PendingRead>::iterator> reads;
+    };
+
+    std::deque<Chunk> chunks;
+    unsigned submitted = 0;
+    auto submitNext = [&] {
+        if (submitted < count)
+        {
+            Chunk c {first + submitted, std::min (chunk, count - submitted), {}};
+            std::vector<unsigned> wanted;
+            for (unsigned i = 0; i < 2 * c.count; ++i)
+            {
+                if (pages & (1 << (i % 2)))
+                {
+                    wanted.push_back (14 + 2 * c.first + i);
+                }
+            }
+            c.reads = submitReads (wanted);
+            submitted += c.count;
+            chunks.push_back (std::move (c));
+        }
+    };
 
-    midiout->openPort(m_devOut-1);
-    midiin->openPort(m_devIn-1);
+    std::vector<uint8_t> chunkData;
+    std::vector<uint8_t> patchData;
+    try
+    {
+        // Keep the next chunk on the wire while passing on the patches of the current one
+        submitNext();
+        submitNext();
+        while (!chunks.empty())
+        {
+            Chunk & c = chunks.front();
+            chunkData.assign (c.count * patchSize, 0);
+            for (auto read : c.reads)
+            {
+                awaitRead (read);
 
-    midiin->ignoreTypes(false, true, true);
+                // Pages fetched along with the wanted ones are passed on as zeros
+                for (unsigned i = 0; i < read->count; ++i)
+                {
+                    unsigned p = read->first + i - 14 - 2 * c.first;
+                    if (pages & (1 << (p % 2)))
+                    {
+                        auto data = read->data.begin() + i * PageFramer::dataSize;
+                        std::copy (data, data + PageFramer::dataSize, chunkData.begin() + p * PageFramer::dataSize);
+                    }
+                }
+            }
+            submitNext();
+            sendReads();
 
-    //std::cout << "Request device ID" << std::endl;
-    RequestIdMessage reqID;
-    auto message = reqID.getMessageData();
-    midiout->sendMessage(&message);
+            for (unsigned i = 0; i < c.count; ++i)
+            {
+                patchData.assign (&chunkData[i * patchSize], &chunkData[(i + 1) * patchSize]);
+                sink (c.first + i, patchData);
+            }
+            for (auto read : c.reads)
+            {
+                dropRead (read);
+            }
+            chunks.pop_front();
+        }
+    }
+    catch (...)
+    {
+        for (auto & c : chunks)
+        {
+            for (auto read : c.reads)
+            {
+                dropRead (read);
+            }
+        }
+        throw;
+    }
+}
 
-    //std::cout << "Wait for device ID" << std::endl;
-    expect.clear();
-    expectMask.clear();
-    expect.push_back (0xf0); expectMask.push_back (0xff);
-    expect.push_back (0x7e); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0x00);
-    expect.push_back (0x06); expectMask.push_back (0xff);
-    expect.push_back (0x02); expectMask.push_back (0xff);
-    expect.push_back (0x41); expectMask.push_back (0xff);
-    expect.push_back (0x14); expectMask.push_back (0xff);
-    expect.push_back (0x03); expectMask.push_back (0xff);
-    result = waitForMessage (midiin, expect, expectMask);
+std::vector<MIDI::PatchResult> MIDI::restorePatches (unsigned first, unsigned count, const PatchSource & source, unsigned window, unsigned maxAttempts)
+{
+    // Patches between identity pings that adapt the pacing, as in sendPatches().
+    const unsigned pingInterval = 8;
 
-    if (result.size() == 0)
+    /** A patch on its way through the pipeline. */
+    struct InFlight
     {
-        throw std::runtime_error ("Could not communicate with ES-8");
+        unsigned patch;
+        std::vector<uint8_t> data;
+        std::list<PendingRead>::iterator read;
+    };
+
+    connect();
+
+    std::vector<PatchResult> results;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        results.push_back ({first + i, 0, false});
     }
 
-    std::this_thread::sleep_for(2ms);
+    std::deque<InFlight> retry;
+    std::deque<InFlight> written;
+    std::deque<InFlight> requested;
+    unsigned next = 0;
+    unsigned writes = 0;
 
-    //std::cout << "Request system pages" << std::endl;
-    RequestDataMessage reqDat(0);
-    message = reqDat.getMessageData();
-    midiout->sendMessage(&message);
+    try
+    {
+        while (next < count || !retry.empty() || !written.empty() || !requested.empty())
+        {
+            // Write the next patch, failed ones first
+            bool wrote = false;
+            if (!retry.empty() || next < count)
+            {
+                InFlight item;
+                if (!retry.empty())
+                {
+                    item = std::move (retry.front());
+                    retry.pop_front();
+                }
+                else
+                {
+                    item.patch = first + next;
+                    item.data = source (first + next);
+                    ++next;
+                }
+                sendPatch (item.patch, item.data);
+                ++results[item.patch - first].attempts;
+                ++writes;
+                written.push_back (std::move (item));
+                wrote = true;
+            }
 
-    expect.clear();
-    expectMask.clear();
-    expect.push_back (0xf0); expectMask.push_back (0xff);
-    expect.push_back (0x41); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0x00);
-    expect.push_back (0x00); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0xff);
-    expect.push_back (0x00); expectMask.push_back (0xff);
-    expect.push_back (0x14); expectMask.push_back (0xff);
-    expect.push_back (0x12); expectMask.push_back (0xff);
+            // Read back patches written window patches ago, or all once nothing is left to write
+            while (!written.empty() && (written.size() > window || !wrote))
+            {
+                requested.push_back (std::move (written.front()));
+                written.pop_front();
 
-    result = waitForMessage (midiin, expect, expectMask);
+                // A lost read back is retried, and once the retries run out the patch is sent again
+                InFlight & item = requested.back();
+                item.read = submitRead (14 + 2 * item.patch, 2);
+                item.read->mayFail = true;
+                sendReads();
+            }
 
-    if (result.size() == 0)
+            // Compare the read back that arrived during this write, keep the
+            // newest one on the wire. Before a ping all of them are taken, so
+            // that the ping only waits for the writes.
+            bool pingNow = wrote && writes % pingInterval == 0;
+            while (requested.size() > (wrote && !pingNow ? 1 : 0))
+            {
+                awaitRead (requested.front().read);
+                InFlight item = std::move (requested.front());
+                requested.pop_front();
+
+                // Intact pages are recorded as the device contents by the
+                // read, the others are unknown, so that a retry sends them.
+                for (unsigned i = 0; i < 2; ++i)
+                {
+                    if (item.read->state[i] != 1)
+                    {
+                        m_knownPages.erase (item.read->first + i);
+                    }
+                }
+                bool matches = !item.read->failed && item.read->data == item.data;
+                dropRead (item.read);
+
+                PatchResult & result = results[item.patch - first];
+                if (matches)
+                {
+                    result.verified = true;
+                }
+                else if (result.attempts < maxAttempts)
+                {
+                    m_pacer.slowDown();
+                    retry.push_back (std::move (item));
+                }
+            }
+
+            if (pingNow)
+            {
+                ping();
+            }
+        }
+    }
+    catch (...)
     {
-        throw std::runtime_error ("Could not communicate with ES-8");
+        for (auto & item : requested)
+        {
+            dropRead (item.read);
+        }
+        throw;
     }
 
-    for (auto i = 0; i < 15; ++i) 
+    return results;
+}
+
+std::vector<uint8_t> MIDI::retrieveSystem ()
+{
+    connect();
+
+    // The last system pages share their addresses with patch 0, so reads
+    // of it must not be on the wire at the same time.
+    for (auto read = m_reads.begin(); read != m_reads.end(); ++read)
     {
-        //std::cout << "Wait for patch (part " << (i+2) << ")" << std::endl;
-        auto result2 = waitForMessage (midiin, expect, expectMask);
-        if (result2.size() == 0)
+        if (read->first < systemPages)
         {
-            throw std::runtime_error ("Could not communicate with ES-8");
+            awaitRead (read);
         }
+    }
 
-        result.insert(result.end(), result2.begin(), result2.end());
+    auto read = submitRead (0, systemPages);
+    read->current = false;
+    try
+    {
+        awaitRead (read);
+    }
+    catch (...)
+    {
+        dropRead (read);
+        throw;
     }
+    auto result = std::move (read->data);
+    dropRead (read);
     return result;
 }
 
@@ -386,7 +1019,7 @@ std::vector<uint8_t> MIDI::scrambleData(const std::vector<uint8_t> & dataIn)
 {
     std::vector<uint8_t> result;
     size_t i = 0;
-    for (auto block = 0; block < dataIn.size()/(125); ++block)
+    for (size_t block = 0; block < dataIn.size()/(125); ++block)
     {
         // reserve space for SysEx protocol
         for (size_t j = 0; j < 10; ++j)
@@ -421,59 +1054,53 @@ std::vector<uint8_t> MIDI::scrambleData(const std::vector<uint8_t> & dataIn)
 std::vector<uint8_t> MIDI::unscrambleData(const std::vector<uint8_t> & dataIn)
 {
     std::vector<uint8_t> result;
+    result.reserve (dataIn.size() / PageFramer::pageSize * PageFramer::dataSize);
 
-    for (auto block = 0; block < dataIn.size()/155; ++block)
-    {
-        std::vector<uint8_t> data (&dataIn[block * 155], &dataIn[block * 155] + 155);
-        
-        //std::cout << "Input data: " << data.size() << std::endl;
-        //std::cout << std::hex;
-        //std::cout << "Exclusive status: " << unsigned (data[0]) << std::endl;
-        //std::cout << "Manufacturer ID: " << unsigned (data[1]) << std::endl;
-        //std::cout << "Device ID: " << unsigned (data[2]) << std::endl;
-        //std::cout << "Model ID: " << unsigned (data[3]) << " " << unsigned (data[4]) << " " << unsigned (data[5]) << " " << unsigned (data[6]) << " " << std::endl;
-        //std::cout << "Command: " << unsigned (data[7]) << std::endl;
-        //std::cout << "Message ID: " << unsigned (data[8]) << " " << unsigned(data[9]) << std::endl;
-
-        unsigned checksum = 0;
-        for (size_t i = 8; i < data.size()-2; ++i)
-        {
-            checksum += data[i];
-        }
-    
-        //std::cout << "Checksum: " << unsigned (data[data.size()-2]) << std::endl;
-        bool chkOk = (((unsigned (data[data.size()-2]) + checksum) & 0x7f) == 0);
-        std::cout << "Checksum test: " << (chkOk ? "OK" : "FAIL") << std::endl;
-        //std::cout << "End marker: " << unsigned (data[data.size()-1]) << std::endl;
-        //std::cout << std::dec;
-        if (!chkOk)
+    PageFramer framer;
+    framer.route (0, 1 << 14, [&result] (unsigned, const uint8_t * data, bool valid) {
+        if (!valid)
         {
             throw std::runtime_error ("MIDI data checksum failed");
         }
-    
-        std::vector<uint8_t> temp;
-        for (size_t i = 10; i < data.size()-2; ++i)
-        {
-            if (temp.size() < 7)
-            {
-                temp.push_back(data[i]);
-            }
-            else
-            {
-                temp.push_back(data[i]);
-                for (size_t j = 0; j < 7; ++j)
-                {
-                    result.push_back(temp[j+1] + ((temp[0] << (j+1)) & 0x80));
-                }
-                temp.clear();
-            }
-        }
-    
-        for (size_t j = 0; j < temp.size()-1; ++j)
-        {
-    	    result.push_back(temp[j+1] + ((temp[0] << (j+1)) & 0x80));
-        }
+        result.insert (result.end(), data, data + PageFramer::dataSize);
+    });
+    framer.feed (dataIn.data(), dataIn.size());
+
+    if (framer.rejected() != 0)
+    {
+        throw std::runtime_error ("Malformed MIDI data");
     }
     return result;
 }
 
+bool MIDI::unscramblePage(const uint8_t * data, std::vector<uint8_t> & out)
+{
+    //std::cout << "Exclusive status: " << unsigned (data[0]) << std::endl;
+    //std::cout << "Manufacturer ID: " << unsigned (data[1]) << std::endl;
+    //std::cout << "Device ID: " << unsigned (data[2]) << std::endl;
+    //std::cout << "Model ID: " << unsigned (data[3]) << " " << unsigned (data[4]) << " " << unsigned (data[5]) << " " << unsigned (data[6]) << " " << std::endl;
+    //std::cout << "Command: " << unsigned (data[7]) << std::endl;
+    //std::cout << "Message ID: " << unsigned (data[8]) << " " << unsigned(data[9]) << std::endl;
+
+    unsigned checksum = 0;
+    for (size_t i = 8; i < 155-2; ++i)
+    {
+        checksum += data[i];
+    }
+
+    if (((unsigned (data[155-2]) + checksum) & 0x7f) != 0)
+    {
+        return false;
+    }
+
+    // Groups of one byte holding the high bits followed by up to 7 bytes holding the low bits
+    for (size_t group = 10; group < 155-2; group += 8)
+    {
+        uint8_t msb = data[group];
+        for (size_t j = 1; j < 8 && group + j < 155-2; ++j)
+        {
+            out.push_back(data[group + j] + ((msb << j) & 0x80));
+        }
+    }
+    return true;
+}
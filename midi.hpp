@@ -3,12 +3,27 @@
 
 #pragma once
 
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <list>
+#include <deque>
+#include <map>
 #include "midimessages.hpp"
+#include "writepacer.hpp"
+#include "readplanner.hpp"
+
+class SysExQueue;
+class MidiTransport;
+class PageFramer;
+class PageCache;
 
 /**
  * Handle MIDI communication.
  * 
- * Uses RtMidi internally.
+ * Uses RtMidi by default, or any other MidiTransport. The transport is
+ * opened and the ES-8 is identified on the first transfer; later
+ * transfers reuse the open session.
  */
 class MIDI
 {
@@ -18,27 +33,232 @@ class MIDI
          *
          * @param devin Index of the MIDI in device to use to communicate with the ES-8
          * @param devout Index of the MIDI in device to use
+         * @param bytesPerSecond Byte budget of the MIDI link for writes, 0 for no limit
          */
-        MIDI (unsigned devin, unsigned devout);
+        MIDI (unsigned devin, unsigned devout, unsigned bytesPerSecond = 0);
+
+        /**
+         * Constructor
+         *
+         * @param transport Port I/O to use
+         * @param bytesPerSecond Byte budget of the MIDI link for writes, 0 for no limit
+         */
+        MIDI (std::unique_ptr<MidiTransport> transport, unsigned bytesPerSecond = 0);
+        ~MIDI ();
+
+        MIDI (const MIDI &) = delete;
+        MIDI & operator= (const MIDI &) = delete;
+
+        /**
+         * Identity reply of the ES-8, connects if necessary.
+         */
+        const std::vector<uint8_t> & identity ();
 
         /**
          * Retrieve one or more patches from the ES-8
          *
+         * Uses a read started by prefetchPatches() if there is one.
+         *
          * @param patch Patch number to start with
          * @param count Number of patches to retrieve
          */
         std::vector<uint8_t> retrievePatch (unsigned patch, unsigned count = 1);
 
+        /**
+         * Start reading patches that retrievePatch() will be asked for later.
+         *
+         * The requests are planned with planPageRanges() and sent right
+         * away, several at a time, so scattered patches cost one round trip
+         * instead of one each. Each patch is handed out once by
+         * retrievePatch() for each time it is listed.
+         *
+         * @param patches Patch numbers, a patch listed twice is read once and handed out twice
+         */
+        void prefetchPatches (const std::vector<unsigned> & patches);
+
+        /** Receives one patch retrieved by retrievePatches(). */
+        typedef std::function<void (unsigned patch, const std::vector<uint8_t> & data)> PatchSink;
+
+        /**
+         * Retrieve a range of patches with a few large requests.
+         *
+         * Each page is verified and unscrambled as it arrives, and the
+         * patches of each request are passed on as soon as it is complete,
+         * so memory use does not depend on the number of patches. Missing
+         * and corrupt pages are requested again, see readStats().
+         *
+         * The requests are planned with planPageRanges(). Reading only one
+         * of the two pages of each patch (see Field::pageMask()) moves half
+         * the bytes on a slow link, e.g. for listing names; on a fast link
+         * one request for both pages may be cheaper.
+         *
+         * @param first First patch number
+         * @param count Number of patches to retrieve
+         * @param sink Called once per patch, in order
+         * @param pages Pages of each patch to read, bit 0 for the first and bit 1 for the second, the other one is passed on as zeros
+         */
+        void retrievePatches (unsigned first, unsigned count, const PatchSink & sink, unsigned pages = 3);
+
         /**
          * Send one patch to the ES-8
          *
+         * Pages that match the known contents of the device (see
+         * setKnownPatch()) are skipped, see writeStats(). Only pages read
+         * from or written to the device in this session are known, pages
+         * from a cache are always sent.
+         *
          * @param patch Patch number to start with
          * @param data The patch data
          */
         void sendPatch (unsigned patch, std::vector<uint8_t> data);
 
+        /**
+         * Record the contents of a patch on the device, e.g. read back after writing it.
+         *
+         * Patches read or written in this session are recorded anyway.
+         */
+        void setKnownPatch (unsigned patch, const std::vector<uint8_t> & data);
+
+        /** Forget the known contents of the device, so that the following writes send every page. */
+        void clearKnownPatches ();
+
+        /**
+         * Take pages read or written earlier in this session from the known
+         * contents of the device instead of reading them again.
+         *
+         * Only safe as long as nothing else changes the patches, e.g. for
+         * the duration of one program.
+         */
+        void reuseKnownPages (bool reuse);
+
+        /**
+         * Wait until the device has taken all pages written so far and
+         * adapt the write pacing to how long that took.
+         */
+        void confirmWrites ();
+
+        /** Supplies the data of one patch to sendPatches(). */
+        typedef std::function<std::vector<uint8_t> (unsigned patch)> PatchSource;
+
+        /**
+         * Send a range of patches to the ES-8, paced by pacer().
+         *
+         * The device is pinged regularly to adapt the pacing, and once at the
+         * end to make sure it has taken all pages.
+         *
+         * @param first First patch number
+         * @param count Number of patches to send
+         * @param source Called once per patch, in order
+         */
+        void sendPatches (unsigned first, unsigned count, const PatchSource & source);
+
+        /** Outcome of writing one patch with restorePatches(). */
+        struct PatchResult
+        {
+            unsigned patch;
+            /** Number of times the patch was written. */
+            unsigned attempts;
+            /** True if the read back matched the written data. */
+            bool verified;
+        };
+
+        /**
+         * Send a range of patches to the ES-8 and verify each one by reading
+         * it back.
+         *
+         * Reading back a patch overlaps with writing the following ones.
+         * Patches that do not match, or whose read back is still missing
+         * pages after the retries, are sent again, more slowly. The device
+         * is pinged every few patches to adapt the pacing.
+         *
+         * @param first First patch number
+         * @param count Number of patches to send
+         * @param source Called once per patch, in order
+         * @param window Number of patches written before the first read back
+         * @param maxAttempts Number of writes per patch before giving up
+         * @return One result per patch, in order
+         */
+        std::vector<PatchResult> restorePatches (unsigned first, unsigned count, const PatchSource & source, unsigned window = 4, unsigned maxAttempts = 3);
+
+        /** Write scheduling and statistics of this session. */
+        const WritePacer & pacer () const;
+
+        /** Counters of the page reads of this session. */
+        struct ReadStats
+        {
+            /** RQ1 messages sent. */
+            unsigned requests = 0;
+            /** Pages requested, including the ones requested again. */
+            unsigned pages = 0;
+            /** Times a read was asked again for missing or corrupt pages. */
+            unsigned retries = 0;
+            /** Pages requested again. */
+            unsigned retriedPages = 0;
+            /** Pages taken from the cache instead of the device. */
+            unsigned cached = 0;
+            /** Pages read or written earlier in the session, see reuseKnownPages(). */
+            unsigned reused = 0;
+        };
+
+        /** Read statistics of this session. */
+        const ReadStats & readStats () const;
+
+        /** Costs the requests for a set of pages are planned with, see planPageRanges(). */
+        struct ReadCosts
+        {
+            /** Overhead of one request, measured as the round trip of an identity request. */
+            std::chrono::microseconds request;
+            /** Time per page, measured while the pages of a read stream in. */
+            std::chrono::microseconds page;
+        };
+
+        /** Current read costs. */
+        const ReadCosts & readCosts () const;
+
+        /** Plan reads with fixed costs instead of measured ones. */
+        void setReadCosts (const ReadCosts & costs);
+
+        /** Counters of the page writes of this session. */
+        struct WriteStats
+        {
+            /** DT1 pages sent. */
+            unsigned pages = 0;
+            /** Pages not sent because the device holds them already. */
+            unsigned skipped = 0;
+        };
+
+        /** Write statistics of this session. */
+        const WriteStats & writeStats () const;
+
+        /**
+         * Set how long a read may stay silent before its missing pages are
+         * requested again (default 1 s).
+         */
+        void setReadTimeout (std::chrono::milliseconds timeout);
+
+        /**
+         * Take patch pages from a cache of the device where possible, and
+         * keep the cache up to date with the pages read from and written
+         * to the device.
+         *
+         * @param cache The cache, selected for the device on connecting, nullptr for none
+         * @param refresh Read every page from the device, only updating the cache
+         */
+        void setCache (PageCache * cache, bool refresh = false);
+
+        /**
+         * Read every page from the device, only updating the cache, see setCache().
+         *
+         * @return The previous setting
+         */
+        bool setRefresh (bool refresh);
+
         /**
          * Retrieve global parameters from the ES-8
+         *
+         * Missing and corrupt pages are requested again like those of patches.
+         *
+         * @return The decoded system pages, 125 bytes each
          */
         std::vector<uint8_t> retrieveSystem ();
 
@@ -57,16 +277,136 @@ class MIDI
          */
         static std::string midiOutName(unsigned i);
 
-        /** Unscramble 7-bit encoded data to 8-bit. */
+        /**
+         * Unscramble a byte stream of DT1 pages to 8-bit data.
+         *
+         * @throw std::runtime_error If a checksum is wrong or the stream holds anything but DT1 pages.
+         */
         static std::vector<uint8_t> unscrambleData(const std::vector<uint8_t> & dataIn);
 
+        /**
+         * Verify the checksum of one 155 byte DT1 page and unscramble it.
+         *
+         * @param page The page, including the SysEx header.
+         * @param out Receives the 125 data bytes, appended.
+         * @return False if the checksum is wrong (nothing is appended).
+         */
+        static bool unscramblePage(const uint8_t * page, std::vector<uint8_t> & out);
+
         /** Scramble 8-bit data to 7-bit. */
         static std::vector<uint8_t> scrambleData(const std::vector<uint8_t> & dataIn);
 
     private:
-        /** Index of the MIDI in device to use to communicate with the ES-8. */
-        unsigned m_devIn;
-        /** Index of the MIDI out device to use to communicate with the ES-8. */
-        unsigned m_devOut;
+        /** Open the ports and identify the ES-8, unless already done. */
+        void connect ();
+
+        /** Request the identity of the ES-8 and wait for the reply. */
+        std::vector<uint8_t> requestIdentity ();
+
+        /** Send a RQ1 for a range of pages. */
+        void requestPages (unsigned page, unsigned count);
+
+        /** Measure the round trip of an identity request and adapt the pacing. */
+        void ping ();
+
+        /**
+         * Wait for a message other than a DT1 page. Pages arriving meanwhile
+         * are dispatched to their routes.
+         *
+         * @return The first message matching expect under expectMask, empty on timeout.
+         */
+        std::vector<uint8_t> waitForMessage (const std::vector<uint8_t> & expect, const std::vector<uint8_t> & expectMask);
+
+        typedef std::chrono::steady_clock Clock;
+
+        /** A RQ1 for a range of pages, queued, on the wire or complete. */
+        struct PendingRead
+        {
+            unsigned first;
+            unsigned count;
+            /** Per page: 0 missing, 1 received, 2 received with a wrong checksum. */
+            std::vector<uint8_t> state;
+            /** Pages received, including corrupt ones. */
+            unsigned received;
+            unsigned corrupt;
+            /** Decoded data, 125 bytes per page. */
+            std::vector<uint8_t> data;
+            bool sent;
+            unsigned retries;
+            /** Route of the pages in m_framer. */
+            unsigned route;
+            /** False once a page of the read was written, the data may predate the write. */
+            bool current;
+            /** Prefetched patches still to hand out, with pages in this read. */
+            std::vector<unsigned> patches;
+            /** Arrival of the first page, to measure the time per page. */
+            Clock::time_point firstPage;
+            /** Give up or send again if no page arrived by then. */
+            Clock::time_point deadline;
+            /** Set failed instead of throwing when the retries run out. */
+            bool mayFail;
+            /** The retries ran out, the pages still missing or corrupt are lost. */
+            bool failed;
+        };
+
+        /** Queue a read and route its pages to it. */
+        std::list<PendingRead>::iterator submitRead (unsigned first, unsigned count);
+
+        /**
+         * Queue the reads that planPageRanges() plans for a set of pages.
+         * Runs of pages in the cache become reads that are complete already.
+         */
+        std::vector<std::list<PendingRead>::iterator> submitReads (const std::vector<unsigned> & pages);
+
+        /** Plan the requests for a set of pages with the current read costs. */
+        std::vector<PageRange> planReads (const std::vector<unsigned> & pages) const;
+
+        /** Send queued reads as long as the pages on the wire fit into the receive queue. */
+        void sendReads ();
+
+        /**
+         * Wait until all pages of a read have arrived intact, dispatching any
+         * pages that arrive meanwhile and asking again for missing or corrupt
+         * pages of any read.
+         */
+        void awaitRead (std::list<PendingRead>::iterator read);
+
+        /** Request the missing and corrupt pages of a read again, after a growing pause. */
+        void retryRead (PendingRead & read);
+
+        /** Remove a read and its route. */
+        void dropRead (std::list<PendingRead>::iterator read);
+
+        /** Take one incoming message and dispatch it, false on timeout. */
+        bool dispatchMessage (Clock::time_point deadline);
+
+        WritePacer m_pacer;
+        ReadStats m_readStats;
+        ReadCosts m_readCosts;
+        /** False once setReadCosts() fixed the costs. */
+        bool m_measureCosts;
+        /** False while the time per page is still the default. */
+        bool m_pageCostMeasured;
+        WriteStats m_writeStats;
+        /** Last known contents of the device, 125 decoded bytes per page address. */
+        std::map<unsigned, std::vector<uint8_t>> m_knownPages;
+        std::chrono::milliseconds m_readTimeout;
+        /** Incoming messages, filled by the transport. Outlives m_transport. */
+        std::unique_ptr<SysExQueue> m_queue;
+        /** Buffer for the message taken from m_queue, reserved once. */
+        std::vector<uint8_t> m_received;
+        std::unique_ptr<MidiTransport> m_transport;
+        /** Checks incoming DT1 pages and hands them to whoever requested them. */
+        std::unique_ptr<PageFramer> m_framer;
+        /** Reads in the order they were submitted. */
+        std::list<PendingRead> m_reads;
+        /** Messages other than DT1 pages that arrived while waiting for pages. */
+        std::deque<std::vector<uint8_t>> m_messages;
+        PageCache * m_cache;
+        bool m_refresh;
+        bool m_reuseKnown;
+        bool m_open;
+        /** Identity reply, empty until connected. */
+        std::vector<uint8_t> m_identity;
 };
 
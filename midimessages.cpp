@@ -47,7 +47,7 @@ void WritePageMessage::constructMessage ()
         checksum += m_pageData[i];
         data()[i] = m_pageData[i];
     }
-    data()[155-2] = (0x80 - ((checksum + pageHi + pageLo) & 0x7f)); // Checksum
+    data()[155-2] = (0x80 - ((checksum + pageHi + pageLo) & 0x7f)) & 0x7f; // Checksum
     data()[155-1] = (0xf7); // End SysEx
 }
 
@@ -74,7 +74,7 @@ void RequestDataMessage::constructMessage ()
     data().push_back (pageLo); // Start page
     data().push_back (lengthHi); // Additional pages
     data().push_back (lengthLo); // Additional pages
-    data().push_back (0x80 - ((pageHi + pageLo + lengthHi + lengthLo) & 0x7f)); // Checksum
+    data().push_back ((0x80 - ((pageHi + pageLo + lengthHi + lengthLo) & 0x7f)) & 0x7f); // Checksum
     data().push_back (0xf7); // End SysEx
 }
 
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
 
 /**
  * Message to be sent to ES-8 via MIDI.
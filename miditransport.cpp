@@ -0,0 +1,400 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <condition_variable>
+#include <map>
+#include <stdexcept>
+#include <algorithm>
+
+#include "rtmidi-4.0.0/RtMidi.h"
+#include "miditransport.hpp"
+
+#if defined(__LINUX_ALSA__)
+#include <poll.h>
+#include <alsa/asoundlib.h>
+#endif
+
+/**
+ * Run tasks at given points in time on a worker thread.
+ *
+ * Tasks may schedule further tasks. Pending tasks are dropped on
+ * destruction.
+ */
+class DeliveryScheduler
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        DeliveryScheduler () : m_stop (false), m_sequence (0), m_thread ([this] { run(); })
+        {
+        }
+
+        ~DeliveryScheduler ()
+        {
+            {
+                std::lock_guard<std::mutex> lock (m_mutex);
+                m_stop = true;
+            }
+            m_wake.notify_one();
+            m_thread.join();
+        }
+
+        /** Run a task at the given time, tasks with equal times in order. */
+        void at (Clock::time_point time, std::function<void ()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock (m_mutex);
+                m_tasks.emplace (std::make_pair (time, m_sequence++), std::move (task));
+            }
+            m_wake.notify_one();
+        }
+
+    private:
+        void run ()
+        {
+            std::unique_lock<std::mutex> lock (m_mutex);
+            while (!m_stop)
+            {
+                if (m_tasks.empty())
+                {
+                    m_wake.wait (lock);
+                }
+                else if (Clock::now() < m_tasks.begin()->first.first)
+                {
+                    m_wake.wait_until (lock, m_tasks.begin()->first.first);
+                }
+                else
+                {
+                    auto task = std::move (m_tasks.begin()->second);
+                    m_tasks.erase (m_tasks.begin());
+                    lock.unlock();
+                    task();
+                    lock.lock();
+                }
+            }
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        bool m_stop;
+        unsigned long m_sequence;
+        std::map<std::pair<Clock::time_point, unsigned long>, std::function<void ()>> m_tasks;
+        std::thread m_thread;
+};
+
+/** RtMidi input callback, runs on the MIDI input thread. */
+static void receiveRtMidiMessage(double, std::vector<unsigned char> * message, void * receiver)
+{
+    (*static_cast<MidiTransport::Receiver *> (receiver)) (message->data(), message->size());
+}
+
+RtMidiTransport::RtMidiTransport (unsigned devin, unsigned devout) : m_devIn (devin), m_devOut (devout)
+{
+}
+
+RtMidiTransport::~RtMidiTransport ()
+{
+}
+
+void RtMidiTransport::open (Receiver receiver)
+{
+    m_receiver = receiver;
+    try
+    {
+        m_midiOut.reset (new RtMidiOut());
+        m_midiOut->openPort(m_devOut-1);
+
+        m_midiIn.reset (new RtMidiIn(RtMidi::UNSPECIFIED, "ES8cli", 2000));
+        m_midiIn->setCallback(&receiveRtMidiMessage, &m_receiver);
+        m_midiIn->openPort(m_devIn-1);
+        m_midiIn->ignoreTypes(false, true, true);
+    }
+    catch (const RtMidiError &error)
+    {
+        error.printMessage();
+        throw std::runtime_error ("Could not open MIDI ports");
+    }
+}
+
+void RtMidiTransport::send (const std::vector<uint8_t> & message)
+{
+    m_midiOut->sendMessage(&message);
+}
+
+#if defined(__LINUX_ALSA__)
+AlsaRawMidiTransport::AlsaRawMidiTransport (const std::string & device)
+    : m_device (device), m_in (nullptr), m_out (nullptr), m_readBuffer (4096), m_running (false)
+{
+}
+
+AlsaRawMidiTransport::~AlsaRawMidiTransport ()
+{
+    m_running = false;
+    if (m_reader.joinable())
+    {
+        m_reader.join();
+    }
+    if (m_in)
+    {
+        snd_rawmidi_close (m_in);
+    }
+    if (m_out)
+    {
+        snd_rawmidi_close (m_out);
+    }
+}
+
+void AlsaRawMidiTransport::open (Receiver receiver)
+{
+    m_receiver = receiver;
+
+    int err = snd_rawmidi_open (&m_in, &m_out, m_device.c_str(), SND_RAWMIDI_NONBLOCK);
+    if (err < 0)
+    {
+        m_in = m_out = nullptr;
+        throw std::runtime_error ("Could not open raw MIDI device " + m_device + ": " + snd_strerror (err));
+    }
+    // Writes block until the bytes are queued, reads are driven by poll().
+    snd_rawmidi_nonblock (m_out, 0);
+
+    m_running = true;
+    m_reader = std::thread ([this] { read(); });
+}
+
+void AlsaRawMidiTransport::send (const std::vector<uint8_t> & message)
+{
+    size_t written = 0;
+    while (written < message.size())
+    {
+        ssize_t n = snd_rawmidi_write (m_out, message.data() + written, message.size() - written);
+        if (n < 0)
+        {
+            throw std::runtime_error (std::string ("Raw MIDI write failed: ") + snd_strerror (int (n)));
+        }
+        written += size_t (n);
+    }
+}
+
+void AlsaRawMidiTransport::read ()
+{
+    int count = snd_rawmidi_poll_descriptors_count (m_in);
+    std::vector<struct pollfd> fds (count);
+    snd_rawmidi_poll_descriptors (m_in, fds.data(), count);
+
+    while (m_running)
+    {
+        // Wake up regularly to notice m_running going false.
+        if (poll (fds.data(), count, 100) <= 0)
+        {
+            continue;
+        }
+
+        ssize_t n = snd_rawmidi_read (m_in, m_readBuffer.data(), m_readBuffer.size());
+        if (n == -EAGAIN)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            std::cerr << "Raw MIDI read failed: " << snd_strerror (int (n)) << std::endl;
+            break;
+        }
+        m_framer.feed (m_readBuffer.data(), size_t (n), m_receiver);
+    }
+}
+#endif
+
+LoopbackTransport::LoopbackTransport (Responder responder, Clock::duration latency, unsigned bytesPerSecond)
+    : m_responder (responder), m_latency (latency), m_bytesPerSecond (bytesPerSecond)
+{
+}
+
+LoopbackTransport::~LoopbackTransport ()
+{
+}
+
+void LoopbackTransport::open (Receiver receiver)
+{
+    m_receiver = receiver;
+    m_scheduler.reset (new DeliveryScheduler);
+}
+
+LoopbackTransport::Clock::duration LoopbackTransport::transmission (size_t bytes) const
+{
+    if (m_bytesPerSecond == 0)
+    {
+        return Clock::duration (0);
+    }
+    return std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (double (bytes) / m_bytesPerSecond));
+}
+
+void LoopbackTransport::send (const std::vector<uint8_t> & message)
+{
+    m_toDeviceFree = std::max (m_toDeviceFree, Clock::now()) + transmission (message.size());
+
+    // Runs on the scheduler thread, so m_toHostFree needs no lock.
+    m_scheduler->at (m_toDeviceFree + m_latency, [this, message] {
+        std::vector<std::vector<uint8_t>> replies;
+        if (m_responder)
+        {
+            m_responder (message, replies);
+        }
+        else
+        {
+            replies.push_back (message);
+        }
+
+        for (auto & reply : replies)
+        {
+            m_toHostFree = std::max (m_toHostFree, Clock::now()) + transmission (reply.size());
+            m_scheduler->at (m_toHostFree + m_latency, [this, reply] { m_receiver (reply.data(), reply.size()); });
+        }
+    });
+}
+
+RecordingTransport::RecordingTransport (std::unique_ptr<MidiTransport> transport, const std::string & filename)
+    : m_transport (std::move (transport)), m_file (filename)
+{
+    if (!m_file)
+    {
+        throw std::runtime_error ("Could not create " + filename);
+    }
+}
+
+RecordingTransport::~RecordingTransport ()
+{
+    // Stop incoming messages before the file goes away.
+    m_transport.reset();
+}
+
+void RecordingTransport::open (Receiver receiver)
+{
+    m_start = std::chrono::steady_clock::now();
+    m_transport->open ([this, receiver] (const uint8_t * data, size_t size) {
+        record ("in", data, size);
+        receiver (data, size);
+    });
+}
+
+void RecordingTransport::send (const std::vector<uint8_t> & message)
+{
+    record ("out", message.data(), message.size());
+    m_transport->send (message);
+}
+
+void RecordingTransport::record (const char * direction, const uint8_t * data, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+    auto us = std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::steady_clock::now() - m_start).count();
+
+    std::string line = std::to_string (us) + " " + direction;
+    for (size_t i = 0; i < size; ++i)
+    {
+        line += ' ';
+        line += hex[data[i] >> 4];
+        line += hex[data[i] & 0x0f];
+    }
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock (m_mutex);
+    m_file << line;
+}
+
+ReplayTransport::ReplayTransport (const std::string & filename) : m_next (0), m_mismatches (0)
+{
+    std::ifstream file (filename);
+    if (!file)
+    {
+        throw std::runtime_error ("Could not open " + filename);
+    }
+
+    long long lastSent = 0;
+    std::string line;
+    while (std::getline (file, line))
+    {
+        std::istringstream fields (line);
+        long long us;
+        std::string direction;
+        if (!(fields >> us >> direction))
+        {
+            continue;
+        }
+
+        std::vector<uint8_t> data;
+        unsigned byte;
+        while (fields >> std::hex >> byte)
+        {
+            data.push_back (uint8_t (byte));
+        }
+
+        if (direction == "out")
+        {
+            m_exchanges.push_back ({data, {}});
+            lastSent = us;
+        }
+        else if (direction == "in")
+        {
+            Reply reply {std::chrono::microseconds (us - lastSent), data};
+            if (m_exchanges.empty())
+            {
+                m_greeting.push_back (reply);
+            }
+            else
+            {
+                m_exchanges.back().replies.push_back (reply);
+            }
+        }
+        else
+        {
+            throw std::runtime_error ("Invalid session file " + filename);
+        }
+    }
+}
+
+ReplayTransport::~ReplayTransport ()
+{
+}
+
+void ReplayTransport::open (Receiver receiver)
+{
+    m_receiver = receiver;
+    m_scheduler.reset (new DeliveryScheduler);
+
+    auto now = Clock::now();
+    for (auto & reply : m_greeting)
+    {
+        const Reply * r = &reply;
+        m_scheduler->at (now + reply.delay, [this, r] { m_receiver (r->data.data(), r->data.size()); });
+    }
+}
+
+void ReplayTransport::send (const std::vector<uint8_t> & message)
+{
+    if (m_next >= m_exchanges.size())
+    {
+        ++m_mismatches;
+        return;
+    }
+
+    const Exchange & exchange = m_exchanges[m_next++];
+    if (exchange.sent != message)
+    {
+        ++m_mismatches;
+    }
+
+    auto now = Clock::now();
+    for (auto & reply : exchange.replies)
+    {
+        const Reply * r = &reply;
+        m_scheduler->at (now + reply.delay, [this, r] { m_receiver (r->data.data(), r->data.size()); });
+    }
+}
+
+unsigned ReplayTransport::mismatches () const
+{
+    return m_mismatches;
+}
@@ -0,0 +1,237 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+#if defined(__LINUX_ALSA__)
+#include <thread>
+#include <atomic>
+#include "sysexframer.hpp"
+
+typedef struct _snd_rawmidi snd_rawmidi_t;
+#endif
+
+class RtMidiIn;
+class RtMidiOut;
+class DeliveryScheduler;
+
+/**
+ * Port I/O underneath the MIDI class.
+ *
+ * A transport sends complete messages and hands every complete incoming
+ * message to a receiver, from whatever thread it receives them on.
+ */
+class MidiTransport
+{
+    public:
+        /** Receives one complete incoming message. */
+        typedef std::function<void (const uint8_t * data, size_t size)> Receiver;
+
+        virtual ~MidiTransport () {}
+
+        /**
+         * Open the transport.
+         *
+         * @param receiver Called for each incoming message until the transport is destroyed.
+         */
+        virtual void open (Receiver receiver) = 0;
+
+        /** Send one complete message. */
+        virtual void send (const std::vector<uint8_t> & message) = 0;
+};
+
+/**
+ * Transport over RtMidi ports, i.e. a real ES-8.
+ */
+class RtMidiTransport : public MidiTransport
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param devin Index of the MIDI in device (1-based)
+         * @param devout Index of the MIDI out device (1-based)
+         */
+        RtMidiTransport (unsigned devin, unsigned devout);
+        ~RtMidiTransport ();
+
+        void open (Receiver receiver) override;
+        void send (const std::vector<uint8_t> & message) override;
+
+    private:
+        unsigned m_devIn;
+        unsigned m_devOut;
+        /** Used by the RtMidi callback, so it outlives m_midiIn. */
+        Receiver m_receiver;
+        std::unique_ptr<RtMidiIn> m_midiIn;
+        std::unique_ptr<RtMidiOut> m_midiOut;
+};
+
+#if defined(__LINUX_ALSA__)
+/**
+ * Transport over an ALSA raw MIDI device (Linux only), e.g. "hw:1,0,0".
+ *
+ * A reader thread reads raw bytes into a buffer allocated once and frames
+ * SysEx messages in place, so receiving does not allocate per message.
+ * Only SysEx messages are passed on.
+ */
+class AlsaRawMidiTransport : public MidiTransport
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param device ALSA raw MIDI device name, see amidi -l.
+         */
+        AlsaRawMidiTransport (const std::string & device);
+        ~AlsaRawMidiTransport ();
+
+        void open (Receiver receiver) override;
+        void send (const std::vector<uint8_t> & message) override;
+
+    private:
+        /** Reader thread */
+        void read ();
+
+        std::string m_device;
+        snd_rawmidi_t * m_in;
+        snd_rawmidi_t * m_out;
+        Receiver m_receiver;
+        std::vector<uint8_t> m_readBuffer;
+        SysExFramer m_framer;
+        std::atomic<bool> m_running;
+        std::thread m_reader;
+};
+#endif
+
+/**
+ * In-process transport with a simulated link.
+ *
+ * Every message takes the transmission time at the given bandwidth plus
+ * the latency to reach the other side. Messages arriving at the device side
+ * go to a responder, which may answer with any number of messages. Without
+ * a responder, messages are looped back unchanged like with a cable from
+ * MIDI out to MIDI in.
+ */
+class LoopbackTransport : public MidiTransport
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /** Device side: receives one message and appends its replies. */
+        typedef std::function<void (const std::vector<uint8_t> & message, std::vector<std::vector<uint8_t>> & replies)> Responder;
+
+        /**
+         * Constructor
+         *
+         * @param responder Device side, nullptr to loop messages back.
+         * @param latency One-way latency of the link.
+         * @param bytesPerSecond Bandwidth of the link in each direction, 0 for no limit.
+         */
+        LoopbackTransport (Responder responder = nullptr, Clock::duration latency = Clock::duration (0), unsigned bytesPerSecond = 0);
+        ~LoopbackTransport ();
+
+        void open (Receiver receiver) override;
+        void send (const std::vector<uint8_t> & message) override;
+
+    private:
+        Clock::duration transmission (size_t bytes) const;
+
+        Responder m_responder;
+        Clock::duration m_latency;
+        unsigned m_bytesPerSecond;
+        /** Time at which each direction of the link is free again. */
+        Clock::time_point m_toDeviceFree;
+        Clock::time_point m_toHostFree;
+        Receiver m_receiver;
+        std::unique_ptr<DeliveryScheduler> m_scheduler;
+};
+
+/**
+ * Records all messages of another transport into a session file.
+ *
+ * Each line holds the time in microseconds since opening, "out" or "in",
+ * and the message bytes in hex.
+ */
+class RecordingTransport : public MidiTransport
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param transport The transport to record.
+         * @param filename The session file to write.
+         */
+        RecordingTransport (std::unique_ptr<MidiTransport> transport, const std::string & filename);
+        ~RecordingTransport ();
+
+        void open (Receiver receiver) override;
+        void send (const std::vector<uint8_t> & message) override;
+
+    private:
+        /** Append a message to the session file. */
+        void record (const char * direction, const uint8_t * data, size_t size);
+
+        std::unique_ptr<MidiTransport> m_transport;
+        std::ofstream m_file;
+        std::mutex m_mutex;
+        std::chrono::steady_clock::time_point m_start;
+};
+
+/**
+ * Replays a session file written by RecordingTransport.
+ *
+ * The incoming messages that followed a sent message in the recording are
+ * delivered with their original delays after the corresponding message is
+ * sent again, so the replay keeps the timing of the real device.
+ */
+class ReplayTransport : public MidiTransport
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * Constructor
+         *
+         * @param filename Session file to replay.
+         */
+        ReplayTransport (const std::string & filename);
+        ~ReplayTransport ();
+
+        void open (Receiver receiver) override;
+        void send (const std::vector<uint8_t> & message) override;
+
+        /** Number of sent messages that differed from the recording. */
+        unsigned mismatches () const;
+
+    private:
+        /** A recorded incoming message, relative to the preceding sent message. */
+        struct Reply
+        {
+            Clock::duration delay;
+            std::vector<uint8_t> data;
+        };
+
+        /** A recorded sent message and the incoming messages that followed it. */
+        struct Exchange
+        {
+            std::vector<uint8_t> sent;
+            std::vector<Reply> replies;
+        };
+
+        std::vector<Reply> m_greeting;
+        std::vector<Exchange> m_exchanges;
+        size_t m_next;
+        unsigned m_mismatches;
+        Receiver m_receiver;
+        std::unique_ptr<DeliveryScheduler> m_scheduler;
+};
@@ -0,0 +1,163 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <cstdio>
+
+#include "pagecache.hpp"
+
+/** Decoded bytes in one page. */
+static const size_t pageData = 125;
+
+static const char magic[] = { 'E', 'S', '8', 'C', 1 };
+
+PageCache::PageCache (const std::string & filename) : m_filename (filename), m_device (nullptr), m_changed (false)
+{
+    std::ifstream file (filename, std::ios::binary);
+    if (!file)
+    {
+        return;
+    }
+    std::vector<uint8_t> data ((std::istreambuf_iterator<char> (file)), std::istreambuf_iterator<char>());
+
+    // A damaged file is only a cache, it is replaced on the next save
+    size_t pos = 0;
+    auto take = [&] (size_t n) {
+        if (data.size() - pos < n)
+        {
+            throw std::runtime_error ("Truncated cache file");
+        }
+        pos += n;
+        return &data[pos - n];
+    };
+    try
+    {
+        if (!std::equal (magic, magic + sizeof (magic), take (sizeof (magic))))
+        {
+            return;
+        }
+        std::map<std::vector<uint8_t>, Device> devices;
+        while (pos < data.size())
+        {
+            size_t length = *take (1);
+            const uint8_t * id = take (length);
+            std::vector<uint8_t> identity (id, id + length);
+            bool writing = *take (1) & 1;
+            const uint8_t * n = take (2);
+            unsigned count = n[0] | (n[1] << 8);
+
+            Device device;
+            for (unsigned i = 0; i < count; ++i)
+            {
+                const uint8_t * a = take (2);
+                const uint8_t * d = take (pageData);
+                device.pages[a[0] | (a[1] << 8)].assign (d, d + pageData);
+            }
+            // Written to without saving afterwards, the pages may be outdated
+            if (!writing)
+            {
+                devices[identity] = std::move (device);
+            }
+        }
+        m_devices = std::move (devices);
+    }
+    catch (const std::runtime_error &)
+    {
+        m_changed = true;
+    }
+}
+
+void PageCache::setDevice (const std::vector<uint8_t> & identity)
+{
+    m_device = &m_devices[identity];
+}
+
+const std::vector<uint8_t> * PageCache::page (unsigned page) const
+{
+    if (!m_device)
+    {
+        return nullptr;
+    }
+    auto it = m_device->pages.find (page);
+    return it == m_device->pages.end() ? nullptr : &it->second;
+}
+
+void PageCache::store (unsigned page, const uint8_t * data)
+{
+    if (m_device)
+    {
+        m_device->pages[page].assign (data, data + pageData);
+        m_changed = true;
+    }
+}
+
+void PageCache::invalidate (unsigned page)
+{
+    if (!m_device)
+    {
+        return;
+    }
+    if (!m_device->writing)
+    {
+        m_device->writing = true;
+        write();
+    }
+    m_device->pages.erase (page);
+    m_changed = true;
+}
+
+void PageCache::save ()
+{
+    bool flagged = false;
+    for (auto & device : m_devices)
+    {
+        flagged |= device.second.writing;
+        device.second.writing = false;
+    }
+    if (m_changed || flagged)
+    {
+        write();
+        m_changed = false;
+    }
+}
+
+void PageCache::write ()
+{
+    std::vector<uint8_t> data (magic, magic + sizeof (magic));
+    for (auto & device : m_devices)
+    {
+        if (device.second.pages.empty() && !device.second.writing)
+        {
+            continue;
+        }
+        data.push_back (uint8_t (device.first.size()));
+        data.insert (data.end(), device.first.begin(), device.first.end());
+        data.push_back (device.second.writing);
+        data.push_back (device.second.pages.size() & 0xff);
+        data.push_back (device.second.pages.size() >> 8);
+        for (auto & page : device.second.pages)
+        {
+            data.push_back (page.first & 0xff);
+            data.push_back (page.first >> 8);
+            data.insert (data.end(), page.second.begin(), page.second.end());
+        }
+    }
+
+    // Replace the file in one step, so it is never half written
+    std::string temp = m_filename + ".tmp";
+    {
+        std::ofstream file (temp, std::ios::binary);
+        file.write (reinterpret_cast<const char *> (data.data()), data.size());
+        if (!file)
+        {
+            throw std::runtime_error ("Could not write cache file " + temp);
+        }
+    }
+    if (std::rename (temp.c_str(), m_filename.c_str()) != 0)
+    {
+        throw std::runtime_error ("Could not write cache file " + m_filename);
+    }
+}
@@ -0,0 +1,68 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+
+/**
+ * Decoded DT1 pages of ES-8 devices, kept in a file between runs.
+ *
+ * Pages are stored per device, keyed by the identity reply, and per page
+ * address. The file is binary: the magic "ES8C" and a version byte, then
+ * for each device the length and bytes of the identity, a flag byte, the
+ * number of pages as 16-bit little endian, and for each page its address
+ * as 16-bit little endian followed by the 125 data bytes.
+ *
+ * Before the first write to a device, the file is saved with the device
+ * flagged, and the pages of a flagged device are not loaded again. So a
+ * run that ends before saving can not leave pages behind that the device
+ * no longer holds.
+ */
+class PageCache
+{
+    public:
+        /**
+         * Constructor, loads the file if it exists.
+         *
+         * @param filename The cache file.
+         */
+        PageCache (const std::string & filename);
+
+        /** Select the device whose pages are used, by its identity reply. */
+        void setDevice (const std::vector<uint8_t> & identity);
+
+        /** A cached page of the device, nullptr if it is not cached. */
+        const std::vector<uint8_t> * page (unsigned page) const;
+
+        /** Store a page of the device as read from it. */
+        void store (unsigned page, const uint8_t * data);
+
+        /**
+         * Forget a page of the device before writing it.
+         *
+         * The first time for a device, the file is saved with the device flagged.
+         */
+        void invalidate (unsigned page);
+
+        /** Write the file once all writes are done, if anything changed. */
+        void save ();
+
+    private:
+        /** Write the file with the current flags, atomically. */
+        void write ();
+
+        struct Device
+        {
+            bool writing = false;
+            std::map<unsigned, std::vector<uint8_t>> pages;
+        };
+
+        std::string m_filename;
+        std::map<std::vector<uint8_t>, Device> m_devices;
+        Device * m_device;
+        bool m_changed;
+};
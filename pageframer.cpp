@@ -0,0 +1,148 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#include <algorithm>
+#include "pageframer.hpp"
+
+/** DT1 header of the ES-8, byte 2 (the device ID) may be anything. */
+static const uint8_t dt1Header[] = { 0xf0, 0x41, 0x00, 0x00, 0x00, 0x00, 0x14, 0x12 };
+
+PageFramer::PageFramer () : m_nextId (0), m_pos (0), m_page (0), m_checksum (0), m_msb (0), m_dataSize (0), m_pages (0), m_rejected (0)
+{
+}
+
+unsigned PageFramer::route (unsigned first, unsigned count, PageHandler handler)
+{
+    m_routes.push_back ({m_nextId, first, count, handler});
+    return m_nextId++;
+}
+
+void PageFramer::unroute (unsigned id)
+{
+    m_routes.erase (std::remove_if (m_routes.begin(), m_routes.end(), [id] (const Route & r) { return r.id == id; }), m_routes.end());
+}
+
+void PageFramer::clearRoutes ()
+{
+    m_routes.clear();
+}
+
+bool PageFramer::routed (unsigned page) const
+{
+    for (auto & r : m_routes)
+    {
+        if (page - r.first < r.count)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PageFramer::reject ()
+{
+    ++m_rejected;
+    m_pos = 0;
+}
+
+void PageFramer::feed (const uint8_t * data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        uint8_t b = data[i];
+        if (b >= 0xf8)
+        {
+            continue;
+        }
+
+        if (b == 0xf0)
+        {
+            if (m_pos != 0)
+            {
+                reject();
+            }
+            m_pos = 1;
+            m_checksum = 0;
+            m_dataSize = 0;
+            continue;
+        }
+
+        if (m_pos == 0)
+        {
+            continue;
+        }
+
+        if (b & 0x80)
+        {
+            // The routes may have changed while the page was split over several feeds.
+            if (b == 0xf7 && m_pos == pageSize - 1 && routed (m_page))
+            {
+                m_pos = 0;
+                ++m_pages;
+                bool valid = (m_checksum & 0x7f) == 0;
+                for (auto & r : m_routes)
+                {
+                    if (m_page - r.first < r.count)
+                    {
+                        r.handler (m_page, m_data, valid);
+                    }
+                }
+            }
+            else
+            {
+                reject();
+            }
+            continue;
+        }
+
+        size_t pos = m_pos++;
+        if (pos < 8)
+        {
+            if (pos != 2 && b != dt1Header[pos])
+            {
+                reject();
+            }
+        }
+        else if (pos < 10)
+        {
+            m_checksum += b;
+            m_page = pos == 8 ? unsigned (b) << 7 : m_page | b;
+            if (pos == 9 && !routed (m_page))
+            {
+                reject();
+            }
+        }
+        else if (pos < pageSize - 2)
+        {
+            // Groups of one byte holding the high bits followed by up to 7 bytes holding the low bits
+            m_checksum += b;
+            size_t j = (pos - 10) % 8;
+            if (j == 0)
+            {
+                m_msb = b;
+            }
+            else
+            {
+                m_data[m_dataSize++] = b | ((m_msb << j) & 0x80);
+            }
+        }
+        else if (pos == pageSize - 2)
+        {
+            m_checksum += b;
+        }
+        else
+        {
+            reject();
+        }
+    }
+}
+
+unsigned PageFramer::pages () const
+{
+    return m_pages;
+}
+
+unsigned PageFramer::rejected () const
+{
+    return m_rejected;
+}
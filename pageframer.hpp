@@ -0,0 +1,116 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Decode DT1 pages from a stream of MIDI bytes.
+ *
+ * Bytes may arrive in chunks of any size. Each page is checked and decoded
+ * byte by byte as it streams in: the header is compared as soon as each
+ * byte arrives, the Roland checksum over bytes 8..153 is summed up, and
+ * the 7-bit groups are unscrambled into the 125 data bytes. When the page
+ * ends, it is dispatched to every handler routed for its address (bytes 8
+ * and 9), so overlapping requests can be outstanding at the same time.
+ *
+ * Frames that are not a DT1 from the ES-8, DT1 pages of the wrong length
+ * and pages without a route are rejected at the first byte that shows it.
+ * Real-time bytes are skipped.
+ */
+class PageFramer
+{
+    public:
+        /** Length of a DT1 page on the wire. */
+        static const size_t pageSize = 155;
+        /** Decoded data bytes in one page. */
+        static const size_t dataSize = 125;
+
+        /**
+         * Receives one complete page.
+         *
+         * @param page Address of the page.
+         * @param data The 125 decoded bytes.
+         * @param valid False if the checksum is wrong.
+         */
+        typedef std::function<void (unsigned page, const uint8_t * data, bool valid)> PageHandler;
+
+        PageFramer ();
+
+        /**
+         * Dispatch a range of pages to a handler.
+         *
+         * @param first First page address.
+         * @param count Number of pages.
+         * @param handler Called for each page in the range, must not change the routes.
+         * @return Identifies the route for unroute().
+         */
+        unsigned route (unsigned first, unsigned count, PageHandler handler);
+
+        /** Remove a route. */
+        void unroute (unsigned id);
+
+        /** Remove all routes. */
+        void clearRoutes ();
+
+        /** Consume bytes from the stream. */
+        void feed (const uint8_t * data, size_t size);
+
+        /** Number of pages dispatched so far. */
+        unsigned pages () const;
+
+        /** Number of frames rejected so far. */
+        unsigned rejected () const;
+
+        /** Removes a route when it goes out of scope. */
+        class ScopedRoute
+        {
+            public:
+                ScopedRoute (PageFramer & framer, unsigned first, unsigned count, PageHandler handler) : m_framer (framer), m_id (framer.route (first, count, handler))
+                {
+                }
+
+                ~ScopedRoute ()
+                {
+                    m_framer.unroute (m_id);
+                }
+
+                ScopedRoute (const ScopedRoute &) = delete;
+                ScopedRoute & operator= (const ScopedRoute &) = delete;
+
+            private:
+                PageFramer & m_framer;
+                unsigned m_id;
+        };
+
+    private:
+        struct Route
+        {
+            unsigned id;
+            unsigned first;
+            unsigned count;
+            PageHandler handler;
+        };
+
+        /** True if a route covers the page address. */
+        bool routed (unsigned page) const;
+
+        /** Stop collecting the current frame and count it as rejected. */
+        void reject ();
+
+        std::vector<Route> m_routes;
+        unsigned m_nextId;
+        /** Position of the next byte in the current frame, 0 when outside a frame. */
+        size_t m_pos;
+        unsigned m_page;
+        unsigned m_checksum;
+        uint8_t m_msb;
+        uint8_t m_data[dataSize];
+        size_t m_dataSize;
+        unsigned m_pages;
+        unsigned m_rejected;
+};
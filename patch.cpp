@@ -9,6 +9,9 @@
 #include "es8parameters.hpp"
 #include "patch.hpp"
 #include "bitcoder.hpp"
+#include "helpers.h"
+#include "decodeddata.hpp"
+#include "patchfields.hpp"
 
 Patch::Patch ()
 {
@@ -22,29 +25,25 @@ void Patch::setName(std::string name)
         throw std::runtime_error ("Name too long. 32 characters max.");
     }
 
-    BitCodec bc (writeableData());
-
-    Field curField = g_fields.at("ID_PATCH_NAME_");
-    for (auto i = 0; i < curField.numFields(); ++i)
-    {
-        bc.setValue(curField.bitOffset(i), curField.bitLength(), ' ');
-    }
-
-    for (auto i = 0; i < curField.numFields() && i < name.size(); ++i)
+    const FieldLayout & curField = Layout::ID_PATCH_NAME_;
+    for (size_t i = 0; i < curField.numFields && i < name.size(); ++i)
     {
-        if (name[i] < curField.min() || name[i] > curField.max ())
+        if (uint8_t (name[i]) < curField.min || uint8_t (name[i]) > curField.max)
         {
             throw std::runtime_error ("Invalid character in name.");
         }
-        bc.setValue(curField.bitOffset(i), curField.bitLength(), name[i]);
+    }
+
+    PatchFields pf (writeableData());
+    for (size_t i = 0; i < curField.numFields; ++i)
+    {
+        pf.setName(i, i < name.size() ? name[i] : ' ');
     }
 }
 
 void Patch::setPatchMidiChannel(size_t index, Command::Parameter channelParam)
 {
-    BitCodec bc (writeableData());
-
-    Field curField = g_fields.at ("ID_PATCH_MIDI_TX_CH_");
+    const FieldLayout & curField = Layout::ID_PATCH_MIDI_TX_CH_;
 
     unsigned channel = 0;
     if (channelParam.isNumber())
@@ -53,26 +52,25 @@ void Patch::setPatchMidiChannel(size_t index, Command::Parameter channelParam)
     }
     else
     {
-        channel = curField.value(channelParam.str());
+        channel = g_fields.at (FieldId::ID_PATCH_MIDI_TX_CH_).value(channelParam.str());
     }
 
-    if (index > curField.numFields() || index < 1)
+    if (index > curField.numFields || index < 1)
     {
         throw std::runtime_error ("Invalid MIDI setting index.");
     }
-    if (channel < curField.min() || channel > curField.max ())
+    if (channel < curField.min || channel > curField.max)
     {
         throw std::runtime_error ("Invalid MIDI channel.");
     }
     
-    bc.setValue(curField.bitOffset(index-1), curField.bitLength(), channel);
+    PatchFields pf (writeableData());
+    pf.setMidiTxChannel(index-1, channel);
 }
 
 void Patch::setPatchMidiPC(size_t index, Command::Parameter pcParam)
 {
-    BitCodec bc (writeableData());
-
-    Field curField = g_fields.at ("ID_PATCH_MIDI_PC_");
+    const FieldLayout & curField = Layout::ID_PATCH_MIDI_PC_;
 
     unsigned pc = 0;
     if (pcParam.isNumber())
@@ -81,26 +79,24 @@ void Patch::setPatchMidiPC(size_t index, Command::Parameter pcParam)
     }
     else
     {
-        pc = curField.value(pcParam.str());
+        pc = g_fields.at (FieldId::ID_PATCH_MIDI_PC_).value(pcParam.str());
     }
 
-    if (index > curField.numFields() || index < 1)
+    if (index > curField.numFields || index < 1)
     {
         throw std::runtime_error ("Invalid MIDI setting index.");
     }
-    if (pc < curField.min() || pc > curField.max ())
+    if (pc < curField.min || pc > curField.max)
     {
         throw std::runtime_error ("Invalid MIDI program.");
     }
     
-    bc.setValue(curField.bitOffset(index-1), curField.bitLength(), pc);
+    PatchFields pf (writeableData());
+    pf.setMidiPC(index-1, pc);
 }
 
 void Patch::setPatchMidiCC(size_t index, size_t ccindex, Command::Parameter ccParam, unsigned val)
 {
-    Field ccField = g_fields.at ("ID_PATCH_MIDI_CTL1_CC_");
-    Field valField = g_fields.at ("ID_PATCH_MIDI_CTL1_CC_VAL_");
-
     unsigned cc = 0;
     if (ccParam.isNumber())
     {
@@ -108,98 +104,100 @@ void Patch::setPatchMidiCC(size_t index, size_t ccindex, Command::Parameter ccPa
     }
     else
     {
-        cc = ccField.value(ccParam.str());
+        cc = g_fields.at (FieldId::ID_PATCH_MIDI_CTL1_CC_).value(ccParam.str());
     }
 
-    BitCodec bc (writeableData());
-
-    switch (ccindex)
+    if (ccindex < 1 || ccindex > 2)
     {
-        case 1:
-            ccField = g_fields.at ("ID_PATCH_MIDI_CTL1_CC_");
-            valField = g_fields.at ("ID_PATCH_MIDI_CTL1_CC_VAL_");
-            break;
-        case 2:
-            ccField = g_fields.at ("ID_PATCH_MIDI_CTL2_CC_");
-            valField = g_fields.at ("ID_PATCH_MIDI_CTL2_CC_VAL_");
-            break;
-        default:
-            throw std::runtime_error ("Only CC settings 1 or 2 possible");
+        throw std::runtime_error ("Only CC settings 1 or 2 possible");
     }
+
+    const FieldLayout & ccField = PatchFields::ccLayout (ccindex-1);
+    const FieldLayout & valField = PatchFields::ccValueLayout (ccindex-1);
     
-    if (index > ccField.numFields() || index < 1)
+    if (index > ccField.numFields || index < 1)
     {
         throw std::runtime_error ("Invalid MIDI setting index.");
     }
-    if (ccindex < 1 || ccindex > 2)
-    {
-        throw std::runtime_error ("Invalid MIDI CC setting index.");
-    }
-    if (cc < ccField.min() || cc > ccField.max ())
+    if (cc < ccField.min || cc > ccField.max)
     {
         throw std::runtime_error ("Invalid MIDI CC.");
     }
-    if (val < valField.min() || val > valField.max ())
+    if (val < valField.min || val > valField.max)
     {
         throw std::runtime_error ("Invalid MIDI CC value.");
     }
 
-    bc.setValue(ccField.bitOffset(index-1), ccField.bitLength(), cc);
-    bc.setValue(valField.bitOffset(index-1), valField.bitLength(), val);
+    PatchFields pf (writeableData());
+    pf.setMidiCC(index-1, ccindex-1, cc);
+    pf.setMidiCCValue(index-1, ccindex-1, val);
 }
 
-void Patch::print()
+std::string Patch::name()
 {
-    auto dataCopy = data();
-    BitDecoder bc (dataCopy);
+    if (!fieldValid (FieldId::ID_PATCH_NAME_))
+    {
+        throw std::logic_error ("Patch name not read");
+    }
 
-    std::cout << "Name: ";
-    Field curField = g_fields.at("ID_PATCH_NAME_");
-    for (auto i = 0; i < curField.numFields(); ++i)
+    auto patchData = data();
+    BitDecoder bd (patchData);
+    const Field & field = g_fields.at (FieldId::ID_PATCH_NAME_);
+    std::string result;
+    for (size_t i = 0; i < field.numFields(); ++i)
     {
-        std::cout << char(bc.getValue(curField.bitOffset(i), curField.bitLength()));
+        result += char (bd.getValue (field.bitOffset(i), field.bitLength()));
     }
-    std::cout << std::endl;
+    return result;
+}
 
-    const char *loopStates[] = { "-", "1", "2", "3", "4", "5", "6", "7", "8", "V" };
+std::string Patch::loops()
+{
+    if (!fieldValid (FieldId::ID_PATCH_LOOP_SW_LOOP_) || !fieldValid (FieldId::ID_PATCH_LOOP_SW_LOOP_V))
+    {
+        throw std::logic_error ("Patch loops not read");
+    }
 
-    std::cout << "Loops: ";
-    curField = g_fields.at("ID_PATCH_LOOP_SW_LOOP_");
-    for (auto i = 0; i < curField.numFields(); ++i)
+    auto patchData = data();
+    BitDecoder bd (patchData);
+    const Field & field = g_fields.at (FieldId::ID_PATCH_LOOP_SW_LOOP_);
+    const Field & loopV = g_fields.at (FieldId::ID_PATCH_LOOP_SW_LOOP_V);
+    std::string result;
+    for (size_t i = 0; i < field.numFields(); ++i)
     {
-        std::cout << loopStates[bc.getValue(curField.bitOffset(i), curField.bitLength()) * (i + 1)];
+        result += bd.getValue (field.bitOffset(i), field.bitLength()) ? char ('1' + i) : '-';
     }
-    curField = g_fields.at ("ID_PATCH_LOOP_SW_LOOP_V");
-    std::cout << (bc.getValue(curField.bitOffset(), curField.bitLength()) ? "V" : "-");
-    std::cout << std::endl;
+    result += bd.getValue (loopV.bitOffset(), loopV.bitLength()) ? 'V' : '-';
+    return result;
+}
+
+void Patch::print()
+{
+    DecodedData dec (Field::Patch);
+    dec.decode (data());
+
+    std::cout << "Name: " << name() << std::endl;
+    std::cout << "Loops: " << loops() << std::endl;
 
     std::cout << "Input: ";
-    curField = g_fields.at ("ID_PATCH_INPUT_SELECT");
-    std::cout << curField.value(bc.getValue(curField.bitOffset(), curField.bitLength())); 
+    std::cout << g_fields.at (FieldId::ID_PATCH_INPUT_SELECT).value(dec.value(FieldId::ID_PATCH_INPUT_SELECT));
     std::cout << std::endl;
 
     std::cout << "Output: ";
-    curField = g_fields.at ("ID_PATCH_OUTPUT_SELECT");
-    std::cout << curField.value(bc.getValue(curField.bitOffset(), curField.bitLength())); 
+    std::cout << g_fields.at (FieldId::ID_PATCH_OUTPUT_SELECT).value(dec.value(FieldId::ID_PATCH_OUTPUT_SELECT));
     std::cout << std::endl;
 
     std::cout << "MIDI: ";
-    curField = g_fields.at ("ID_PATCH_MIDI_TX_CH_");
-    for (auto i = 0; i < curField.numFields(); ++i)
+    for (size_t i = 0; i < g_fields.at (FieldId::ID_PATCH_MIDI_TX_CH_).numFields(); ++i)
     {
-        auto ch = bc.getValue(curField.bitOffset(i), curField.bitLength());
+        auto ch = dec.value(FieldId::ID_PATCH_MIDI_TX_CH_, i);
         if (ch > 1)
         {
-            auto pcField = g_fields.at ("ID_PATCH_MIDI_PC_");
-            auto pc = bc.getValue(pcField.bitOffset(i), pcField.bitLength());
-            auto cc1Field = g_fields.at ("ID_PATCH_MIDI_CTL1_CC_");
-            auto cc1 = bc.getValue(cc1Field.bitOffset(i), cc1Field.bitLength());
-            auto cc1ValField = g_fields.at ("ID_PATCH_MIDI_CTL1_CC_VAL_");
-            auto cc1Val = bc.getValue(cc1ValField.bitOffset(i), cc1ValField.bitLength());
-            auto cc2Field = g_fields.at ("ID_PATCH_MIDI_CTL2_CC_");
-            auto cc2 = bc.getValue(cc2Field.bitOffset(i), cc2Field.bitLength());
-            auto cc2ValField = g_fields.at ("ID_PATCH_MIDI_CTL2_CC_VAL_");
-            auto cc2Val = bc.getValue(cc2ValField.bitOffset(i), cc2ValField.bitLength());
+            auto pc = dec.value(FieldId::ID_PATCH_MIDI_PC_, i);
+            auto cc1 = dec.value(FieldId::ID_PATCH_MIDI_CTL1_CC_, i);
+            auto cc1Val = dec.value(FieldId::ID_PATCH_MIDI_CTL1_CC_VAL_, i);
+            auto cc2 = dec.value(FieldId::ID_PATCH_MIDI_CTL2_CC_, i);
+            auto cc2Val = dec.value(FieldId::ID_PATCH_MIDI_CTL2_CC_VAL_, i);
             std::cout << i+1 << ":(CH: " << ch;
             if (pc != 0) std::cout << " PC: " << pc;
             if (cc1 != 0) std::cout << " CC1: " << cc1-1 << " " << cc1Val;
@@ -210,57 +208,19 @@ void Patch::print()
     std::cout << std::endl;
 }
 
-void Patch::writeFileData(std::ostream & s)
+void Patch::writeFileData(std::string & out)
 {
-    auto dataCopy = data();
-    BitDecoder bc (dataCopy);
-
-    for (auto it = g_fields.begin(); it != g_fields.end(); ++it)
-    {
-        if (it->second.type() == Field::Patch)
-        {
-            for (auto i = 0; i < it->second.numFields(); ++i)
-            {
-		if (it->second.numFields() == 1)
-                {
-                    s << it->second.id() << ": " << it->second.value (bc.getValue(it->second.bitOffset(i), it->second.bitLength())) << std::endl;
-                }
-                else
-                {
-                    s << it->second.id() << "" << (i+1) << ": " << it->second.value (bc.getValue(it->second.bitOffset(i), it->second.bitLength()));
-                    if (it->second.id() == "ID_PATCH_NAME_")
-                    {
-                        s << " '" << char(bc.getValue(it->second.bitOffset(i), it->second.bitLength())) << "'";
-                    }
-                    s << std::endl;
-                }
-            }
-        }
-    }
+    writeValues (out, Field::Patch);
 }
 
 void Patch::load(std::string filename)
 {
-    std::ifstream infile (filename);
-    
-    std::string line;
-    std::getline(infile, line);
-    if (line != "ES8cli patch file format 1")
-    {
-        std::cerr << "wrong file format <" << line << ">" << std::endl;
-        throw std::runtime_error ("Wrong patch file format");
-    }
-
-    loadValues (infile);
+    loadValues (loadFile (filename), "ES8cli patch file format 1", "Wrong patch file format");
 }
 
 void Patch::save(std::string filename)
 {
-    std::ofstream backupFile;
-    backupFile.open (filename);
-    backupFile << "ES8cli patch file format 1" << std::endl;
-    writeFileData(backupFile);
-    backupFile.close();
+    saveValues (filename, "ES8cli patch file format 1");
 }
 
 bool Patch::dataValid(std::vector<uint8_t> & data)
@@ -270,26 +230,14 @@ bool Patch::dataValid(std::vector<uint8_t> & data)
 
 void Patch::setLoop(size_t i, bool state)
 {
-    BitCodec bc (writeableData());
-
-    Field curField = g_fields.at ("ID_PATCH_LOOP_SW_LOOP_");
-
-    if (i == 8)
-    {
-        curField = g_fields.at ("ID_PATCH_LOOP_SW_LOOP_V");
-    }
-
-    i = i % 8;
-
-    bc.setValue(curField.bitOffset(i), curField.bitLength(), state ? 1 : 0);
+    PatchFields pf (writeableData());
+    pf.setLoop(i, state);
 }
 
 
 void Patch::setInput(Command::Parameter iParam)
 {
-    BitCodec bc (writeableData());
-
-    Field curField = g_fields.at ("ID_PATCH_INPUT_SELECT");
+    const FieldLayout & curField = Layout::ID_PATCH_INPUT_SELECT;
 
     unsigned i = 0;
     if (iParam.isNumber())
@@ -298,22 +246,21 @@ void Patch::setInput(Command::Parameter iParam)
     }
     else
     {
-        i = curField.value(iParam.str());
+        i = g_fields.at (FieldId::ID_PATCH_INPUT_SELECT).value(iParam.str());
     }
 
-    if (i < curField.min() || i > curField.max ())
+    if (i < curField.min || i > curField.max)
     {
         throw std::runtime_error ("Invalid input select.");
     }
     
-    bc.setValue(curField.bitOffset(), curField.bitLength(), i);
+    PatchFields pf (writeableData());
+    pf.setInputSelect(i);
 }
 
 void Patch::setOutput(Command::Parameter oParam)
 {
-    BitCodec bc (writeableData());
-
-    Field curField = g_fields.at ("ID_PATCH_OUTPUT_SELECT");
+    const FieldLayout & curField = Layout::ID_PATCH_OUTPUT_SELECT;
 
     unsigned o = 0;
     if (oParam.isNumber())
@@ -322,14 +269,14 @@ void Patch::setOutput(Command::Parameter oParam)
     }
     else
     {
-        o = curField.value(oParam.str());
+        o = g_fields.at (FieldId::ID_PATCH_OUTPUT_SELECT).value(oParam.str());
     }
 
-    if (o < curField.min() || o > curField.max ())
+    if (o < curField.min || o > curField.max)
     {
         throw std::runtime_error ("Invalid input select.");
     }
     
-    bc.setValue(curField.bitOffset(), curField.bitLength(), o);
+    PatchFields pf (writeableData());
+    pf.setOutputSelect(o);
 }
-
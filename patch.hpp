@@ -25,8 +25,14 @@ class Patch : public ES8Data
         void setOutput(Command::Parameter o);
         void setLoop(size_t i, bool state);
 
+        /** Patch name, also for partial data holding the name. */
+        std::string name();
+
+        /** Loop states like "12------V", also for partial data holding the loops. */
+        std::string loops();
+
     protected:
-        void writeFileData (std::ostream & s) override;
+        void writeFileData (std::string & out) override;
         bool dataValid(std::vector<uint8_t> & data) override;
 };
 
@@ -0,0 +1,100 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+
+#include "bitcoder.hpp"
+#include "es8layout.hpp"
+
+/**
+ * Typed access to the fields of a 250 byte patch image.
+ *
+ * The layout is known at compile time, so every accessor reduces to a
+ * constant shift and mask. Subindexes are 0-based.
+ */
+class PatchFields
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param data Patch data (250 bytes).
+         */
+        PatchFields (std::vector<uint8_t> & data) : m_data (data)
+        {
+            if (data.size() != 250)
+            {
+                throw std::runtime_error ("Data invalid");
+            }
+        }
+
+        unsigned name (size_t i) const { return get (Layout::ID_PATCH_NAME_, i); }
+        void setName (size_t i, unsigned c) { set (Layout::ID_PATCH_NAME_, i, c); }
+
+        /** Loop state, loops 1 to 8 are 0 to 7, loop V is 8. */
+        bool loop (size_t i) const { return i == 8 ? get (Layout::ID_PATCH_LOOP_SW_LOOP_V, 0) : get (Layout::ID_PATCH_LOOP_SW_LOOP_, i); }
+        void setLoop (size_t i, bool state)
+        {
+            if (i == 8)
+            {
+                set (Layout::ID_PATCH_LOOP_SW_LOOP_V, 0, state ? 1 : 0);
+            }
+            else
+            {
+                set (Layout::ID_PATCH_LOOP_SW_LOOP_, i, state ? 1 : 0);
+            }
+        }
+
+        unsigned inputSelect () const { return get (Layout::ID_PATCH_INPUT_SELECT, 0); }
+        void setInputSelect (unsigned i) { set (Layout::ID_PATCH_INPUT_SELECT, 0, i); }
+
+        unsigned outputSelect () const { return get (Layout::ID_PATCH_OUTPUT_SELECT, 0); }
+        void setOutputSelect (unsigned o) { set (Layout::ID_PATCH_OUTPUT_SELECT, 0, o); }
+
+        unsigned midiTxChannel (size_t slot) const { return get (Layout::ID_PATCH_MIDI_TX_CH_, slot); }
+        void setMidiTxChannel (size_t slot, unsigned ch) { set (Layout::ID_PATCH_MIDI_TX_CH_, slot, ch); }
+
+        unsigned midiPC (size_t slot) const { return get (Layout::ID_PATCH_MIDI_PC_, slot); }
+        void setMidiPC (size_t slot, unsigned pc) { set (Layout::ID_PATCH_MIDI_PC_, slot, pc); }
+
+        /** CC number plus one (0 is OFF) of CC setting 0 or 1. */
+        unsigned midiCC (size_t slot, size_t cc) const { return get (ccLayout (cc), slot); }
+        void setMidiCC (size_t slot, size_t cc, unsigned value) { set (ccLayout (cc), slot, value); }
+
+        unsigned midiCCValue (size_t slot, size_t cc) const { return get (ccValueLayout (cc), slot); }
+        void setMidiCCValue (size_t slot, size_t cc, unsigned value) { set (ccValueLayout (cc), slot, value); }
+
+        static const FieldLayout & ccLayout (size_t cc)
+        {
+            return cc == 0 ? Layout::ID_PATCH_MIDI_CTL1_CC_ : Layout::ID_PATCH_MIDI_CTL2_CC_;
+        }
+
+        static const FieldLayout & ccValueLayout (size_t cc)
+        {
+            return cc == 0 ? Layout::ID_PATCH_MIDI_CTL1_CC_VAL_ : Layout::ID_PATCH_MIDI_CTL2_CC_VAL_;
+        }
+
+    private:
+        unsigned get (const FieldLayout & f, size_t index) const
+        {
+            if (index >= f.numFields)
+            {
+                throw std::out_of_range ("Field index out of range");
+            }
+            return extractBits (m_data.data(), f.offset(index), f.bitLength);
+        }
+
+        void set (const FieldLayout & f, size_t index, unsigned value)
+        {
+            if (index >= f.numFields)
+            {
+                throw std::out_of_range ("Field index out of range");
+            }
+            insertBits (m_data.data(), f.offset(index), f.bitLength, value);
+        }
+
+        std::vector<uint8_t> & m_data;
+};
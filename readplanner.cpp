@@ -0,0 +1,48 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "readplanner.hpp"
+
+std::vector<PageRange> planPageRanges (std::vector<unsigned> pages, double requestCost, double pageCost, unsigned maxCount)
+{
+    if (maxCount == 0)
+    {
+        throw std::logic_error ("Invalid request size");
+    }
+
+    std::sort (pages.begin(), pages.end());
+    pages.erase (std::unique (pages.begin(), pages.end()), pages.end());
+
+    // cost[i] is the cheapest plan for the first i pages, whose last
+    // request starts at page start[i]. A request starting between two
+    // needed pages could start later for less, so only needed pages are
+    // tried as starts, going back as far as maxCount allows.
+    size_t n = pages.size();
+    std::vector<double> cost (n + 1, std::numeric_limits<double>::infinity());
+    std::vector<size_t> start (n + 1, 0);
+    cost[0] = 0;
+    for (size_t i = 1; i <= n; ++i)
+    {
+        for (size_t j = i; j-- > 0 && pages[i - 1] - pages[j] < maxCount; )
+        {
+            double c = cost[j] + requestCost + pageCost * (pages[i - 1] - pages[j] + 1);
+            if (c < cost[i])
+            {
+                cost[i] = c;
+                start[i] = j;
+            }
+        }
+    }
+
+    std::vector<PageRange> ranges;
+    for (size_t i = n; i > 0; i = start[i])
+    {
+        ranges.push_back ({pages[start[i]], pages[i - 1] - pages[start[i]] + 1});
+    }
+    std::reverse (ranges.begin(), ranges.end());
+    return ranges;
+}
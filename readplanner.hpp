@@ -0,0 +1,29 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+
+/** A run of pages requested with one RQ1. */
+struct PageRange
+{
+    unsigned first;
+    unsigned count;
+};
+
+/**
+ * Plan the RQ1 requests that fetch a set of pages at the lowest cost.
+ *
+ * Each request costs its overhead plus the cost of each page it returns,
+ * so two runs of needed pages are merged into one request when the pages
+ * in between cost less than another request, e.g. over USB where a round
+ * trip takes as long as dozens of pages, but hardly ever over DIN.
+ *
+ * @param pages Needed page addresses in any order, duplicates are fetched once
+ * @param requestCost Overhead of one request
+ * @param pageCost Cost of one page, in the same unit
+ * @param maxCount Most pages per request
+ * @return Ranges in ascending order that cover every needed page
+ */
+std::vector<PageRange> planPageRanges (std::vector<unsigned> pages, double requestCost, double pageCost, unsigned maxCount);
@@ -0,0 +1,96 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Cut a raw MIDI byte stream into complete SysEx messages.
+ *
+ * Bytes are collected in a buffer allocated once, and each complete
+ * message is handed on as a pointer into that buffer, so framing never
+ * allocates. Real-time bytes inside a SysEx are skipped, other messages
+ * are ignored, and a SysEx interrupted by a status byte or longer than the
+ * buffer is dropped.
+ */
+class SysExFramer
+{
+    public:
+        /**
+         * Constructor
+         *
+         * @param maxSize Longest SysEx message to accept, including F0 and F7.
+         */
+        SysExFramer (size_t maxSize = 512) : m_buffer (maxSize), m_size (0), m_inSysEx (false), m_dropped (0)
+        {
+        }
+
+        /**
+         * Consume bytes from the stream.
+         *
+         * @param data The bytes.
+         * @param size Number of bytes.
+         * @param deliver Called as deliver(const uint8_t * message, size_t size) for each complete message.
+         */
+        template <typename F>
+        void feed (const uint8_t * data, size_t size, F && deliver)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                uint8_t b = data[i];
+                if (b >= 0xf8)
+                {
+                    continue;
+                }
+
+                if (b == 0xf0)
+                {
+                    if (m_inSysEx)
+                    {
+                        ++m_dropped;
+                    }
+                    m_inSysEx = true;
+                    m_size = 0;
+                }
+                else if (!m_inSysEx)
+                {
+                    continue;
+                }
+                else if ((b & 0x80) && b != 0xf7)
+                {
+                    ++m_dropped;
+                    m_inSysEx = false;
+                    continue;
+                }
+
+                if (m_size == m_buffer.size())
+                {
+                    ++m_dropped;
+                    m_inSysEx = false;
+                    continue;
+                }
+                m_buffer[m_size++] = b;
+
+                if (b == 0xf7)
+                {
+                    m_inSysEx = false;
+                    deliver (m_buffer.data(), m_size);
+                }
+            }
+        }
+
+        /** Number of incomplete or oversized messages dropped. */
+        unsigned dropped () const
+        {
+            return m_dropped;
+        }
+
+    private:
+        std::vector<uint8_t> m_buffer;
+        size_t m_size;
+        bool m_inSysEx;
+        unsigned m_dropped;
+};
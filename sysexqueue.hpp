@@ -0,0 +1,126 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Queue of complete MIDI messages from one producer (the MIDI input thread)
+ * to one consumer.
+ *
+ * The ring itself is lock-free. The mutex and condition variable are only
+ * used to put the consumer to sleep while the ring is empty, so it wakes up
+ * as soon as a message arrives instead of polling.
+ */
+class SysExQueue
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /** Number of messages the ring can hold. */
+        static const size_t capacity = 256;
+
+        SysExQueue () : m_slots (capacity), m_head (0), m_tail (0), m_dropped (0)
+        {
+            // A DT1 page is 155 bytes, so pushing never allocates.
+            for (auto & slot : m_slots)
+            {
+                slot.reserve (256);
+            }
+        }
+
+        /**
+         * Add a message. Producer side only.
+         *
+         * @return False if the ring is full and the message was dropped.
+         */
+        bool push (const uint8_t * data, size_t size)
+        {
+            size_t tail = m_tail.load (std::memory_order_relaxed);
+            if (tail - m_head.load (std::memory_order_acquire) == capacity)
+            {
+                ++m_dropped;
+                return false;
+            }
+
+            m_slots[tail % capacity].assign (data, data + size);
+            m_tail.store (tail + 1, std::memory_order_release);
+
+            // Taking the lock orders the notification after a consumer that
+            // checked the ring and is about to wait.
+            std::lock_guard<std::mutex> lock (m_mutex);
+            m_ready.notify_one();
+            return true;
+        }
+
+        /**
+         * Take the oldest message without waiting. Consumer side only.
+         *
+         * The message is copied out, so the slot keeps its buffer and the
+         * producer never allocates.
+         *
+         * @param message Receives the message, keep it around to reuse its buffer.
+         * @return False if the ring is empty.
+         */
+        bool tryPop (std::vector<uint8_t> & message)
+        {
+            size_t head = m_head.load (std::memory_order_relaxed);
+            if (head == m_tail.load (std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            auto & slot = m_slots[head % capacity];
+            message.assign (slot.begin(), slot.end());
+            slot.clear();
+            m_head.store (head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Take the oldest message, waiting until it arrives or the deadline
+         * passes. Consumer side only.
+         *
+         * @param message Receives the message.
+         * @param deadline Point in time to give up.
+         * @return False on timeout.
+         */
+        bool pop (std::vector<uint8_t> & message, Clock::time_point deadline)
+        {
+            while (!tryPop (message))
+            {
+                std::unique_lock<std::mutex> lock (m_mutex);
+                if (!m_ready.wait_until (lock, deadline, [this] { return !empty(); }))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool empty () const
+        {
+            return m_head.load (std::memory_order_acquire) == m_tail.load (std::memory_order_acquire);
+        }
+
+        /** Number of messages dropped because the ring was full. */
+        size_t dropped () const
+        {
+            return m_dropped.load();
+        }
+
+    private:
+        std::vector<std::vector<uint8_t>> m_slots;
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_tail;
+        std::atomic<size_t> m_dropped;
+        std::mutex m_mutex;
+        std::condition_variable m_ready;
+};
@@ -4,88 +4,896 @@
 #pragma once
 
 #include <vector>
-#include <map>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <memory>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <set>
 
-void testSystemStruct()
+#include "sysexqueue.hpp"
+#include "sysexframer.hpp"
+#include "pageframer.hpp"
+#include "writepacer.hpp"
+#include "readplanner.hpp"
+#include "miditransport.hpp"
+#include "emulator.hpp"
+#include "midi.hpp"
+#include "patch.hpp"
+#include "pagecache.hpp"
+#include "execute.hpp"
+
+/**
+ * Reference decoder using the original one-bit-per-index expansion.
+ * Kept to cross-check and benchmark the packed implementation.
+ */
+class BitwiseDecoder : public BitDecoder
+{
+    public:
+        BitwiseDecoder (const std::vector<uint8_t> & data) : BitDecoder(data), m_ref(data) {}
+
+        unsigned getValue(size_t off, size_t len) override
+        {
+            auto bitData = bitifyData (m_ref);
+            unsigned result = 0;
+            for (size_t i = 0; i < len; ++i)
+            {
+                result += bitData[off+i] << (len-1-i);
+            }
+            return result;
+        }
+
+    private:
+        const std::vector<uint8_t> & m_ref;
+};
+
+/**
+ * Reference codec using the original expand, modify and repack approach.
+ */
+class BitwiseCodec : public BitCodec
+{
+    public:
+        BitwiseCodec (std::vector<uint8_t> & data) : BitCodec(data), m_ref(data) {}
+
+        void setValue(size_t off, size_t len, unsigned bits) override
+        {
+            auto bitData = bitifyData (m_ref);
+            for (size_t i = 0; i < len; ++i)
+            {
+                bitData[off+i] = (bits >> (len-1-i)) & 1;
+            }
+            m_ref = unBitifyData(bitData);
+        }
+
+    private:
+        std::vector<uint8_t> & m_ref;
+};
+
+/** Fill a buffer with reproducible pseudo-random bytes. */
+std::vector<uint8_t> testData(size_t size, unsigned seed = 1)
+{
+    std::mt19937 gen (seed);
+    std::vector<uint8_t> result (size);
+    for (auto & b : result)
+    {
+        b = gen() & 0xff;
+    }
+    return result;
+}
+
+void testBitDecoder()
 {
-    std::vector<unsigned> testMap (8 * 125);
-    std::map<Field::Type, unsigned> numBits;
-    numBits[Field::Globals] = 0;
-    numBits[Field::Patch] = 0;
+    auto data = testData (250);
+    BitDecoder bd (data);
+    BitwiseDecoder ref (data);
+    unsigned errors = 0;
 
-    for (auto it = g_fields.begin(); it != g_fields.end(); ++it)
+    for (size_t len = 1; len <= 16; ++len)
     {
-       for (auto i = 0; i < it->second.numFields(); ++i)
-       {
-           numBits[it->second.type()] += it->second.bitLength();
-           if (it->second.type() == 0)
-           {
-               for (auto j = 0; j < it->second.bitLength(); ++j)
-               {
-                   testMap[it->second.bitOffset(i) + j]++;
-               }
-           }
-       }
+        for (size_t off = 0; off + len <= data.size() * 8; ++off)
+        {
+            if (bd.getValue(off, len) != ref.getValue(off, len))
+            {
+                errors++;
+            }
+        }
     }
 
-    for (auto i = 0; i < 125; ++i)
+    std::cout << "Bit decoder test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testBitCodec()
+{
+    auto data = testData (250);
+    auto refData = data;
+    BitCodec bc (data);
+    BitwiseCodec ref (refData);
+    std::mt19937 gen (2);
+    unsigned errors = 0;
+
+    for (size_t len = 1; len <= 16; ++len)
     {
-        std::cout << i << ": ";
-        for (auto j = 0; j < 8; ++j)
+        for (size_t off = 0; off + len <= data.size() * 8; off += 3)
         {
-            if (testMap[i*8+j] != 1)
+            unsigned value = gen();
+            bc.setValue(off, len, value);
+            ref.setValue(off, len, value);
+            if (data != refData)
             {
-                std::cerr << " Corrupted value map" << std::endl;
+                errors++;
+                data = refData;
             }
-            std::cout <<  unsigned(testMap[i*8+j]);
         }
-        std::cout << std::endl;
     }
+
+    std::cout << "Bit codec test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testDecodedData()
+{
+    unsigned errors = 0;
+    Field::Type types[] = { Field::Patch, Field::Globals };
+
+    for (auto type : types)
+    {
+        auto data = testData (type == Field::Patch ? 250 : 8 * 250, 3);
+        BitDecoder bd (data);
+        DecodedData dec (type);
+        dec.decode (data);
+
+        for (size_t f = 0; f < dec.numFields(); ++f)
+        {
+            for (size_t i = 0; i < dec.field(f).numFields(); ++i)
+            {
+                if (dec.value(f, i) != bd.getValue(dec.field(f).bitOffset(i), dec.field(f).bitLength()))
+                {
+                    errors++;
+                }
+            }
+        }
+
+        std::vector<uint8_t> reencoded (data.size());
+        dec.encode (reencoded);
+        DecodedData dec2 (type);
+        dec2.decode (reencoded);
+        if (dec != dec2)
+        {
+            errors++;
+        }
+    }
+
+    std::cout << "Decoded data test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testPatchFields()
+{
+    // The field map itself is checked at compile time in es8layout.hpp.
+    // Here the typed accessors are checked against the generic field map.
+    auto data = testData (250, 4);
+    BitDecoder bd (data);
+    PatchFields pf (data);
+    unsigned errors = 0;
+
+    auto check = [&] (std::string id, size_t index, unsigned value) {
+        Field f = g_fields.at(id);
+        if (bd.getValue(f.bitOffset(index), f.bitLength()) != value)
+        {
+            errors++;
+        }
+    };
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        pf.setMidiTxChannel(i, i + 1);
+        pf.setMidiPC(i, 100 + i);
+        pf.setMidiCC(i, 1, 20 + i);
+        pf.setMidiCCValue(i, 1, 127 - i);
+        pf.setLoop(i, i % 2);
+        check ("ID_PATCH_MIDI_TX_CH_", i, i + 1);
+        check ("ID_PATCH_MIDI_PC_", i, 100 + i);
+        check ("ID_PATCH_MIDI_CTL2_CC_", i, 20 + i);
+        check ("ID_PATCH_MIDI_CTL2_CC_VAL_", i, 127 - i);
+        check ("ID_PATCH_LOOP_SW_LOOP_", i, i % 2);
+        errors += pf.midiTxChannel(i) != i + 1;
+    }
+    pf.setLoop(8, true);
+    check ("ID_PATCH_LOOP_SW_LOOP_V", 0, 1);
+    pf.setName(3, 'x');
+    check ("ID_PATCH_NAME_", 3, 'x');
+    pf.setOutputSelect(2);
+    check ("ID_PATCH_OUTPUT_SELECT", 0, 2);
+
+    std::cout << "Patch fields test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testFieldRegistry()
+{
+    unsigned errors = 0;
+
+    for (auto & field : g_fields)
+    {
+        std::string id = field.id();
+        errors += g_fields.find (id.data(), id.size()) != &field;
+        errors += &g_fields.at (g_fields.idOf (field)) != &field;
+    }
+    errors += g_fields.find ("ID_PATCH_NAME_1", 15) != nullptr;
+    errors += g_fields.find ("ID_PATCH_NAM", 12) != nullptr;
+    errors += g_fields.find ("", 0) != nullptr;
+    errors += std::string (g_fields.at (FieldId::ID_PATCH_NAME_).id()) != "ID_PATCH_NAME_";
+
+    size_t index = 99;
+    errors += g_fields.resolve ("ID_PATCH_NAME_7", 15, index) != &g_fields.at (FieldId::ID_PATCH_NAME_) || index != 6;
+    errors += g_fields.resolve ("ID_PATCH_LOOP_SW_LOOP_V", 23, index) != &g_fields.at (FieldId::ID_PATCH_LOOP_SW_LOOP_V) || index != 0;
+    errors += g_fields.resolve ("ID_SYSTEM_UNKNOWN_10", 20, index) != &g_fields.at (FieldId::ID_SYSTEM_UNKNOWN_10) || index != 0;
+    errors += g_fields.resolve ("ID_PATCH_NAME_0", 15, index) != nullptr;
+    errors += g_fields.resolve ("ID_PATCH_NAME_17", 16, index) != nullptr;
+    errors += g_fields.resolve ("ID_PATCH_NAME_X", 15, index) != nullptr;
+    errors += g_fields.resolve ("7", 1, index) != nullptr;
+
+    // Alias conversion in both directions
+    auto & output = g_fields.at (FieldId::ID_PATCH_OUTPUT_SELECT);
+    for (unsigned v = 0; v < 3; ++v)
+    {
+        errors += output.value (output.value (v)) != v;
+    }
+    errors += output.value (2) != "BOTH" || output.value (7) != "7";
+    errors += g_fields.at (FieldId::ID_PATCH_LOOP_SW_LOOP_).value ("ON") != 1;
+    unsigned parsed = 0;
+    errors += output.parseValue ("BOT", 3, parsed) || output.parseValue ("BOTHX", 5, parsed) || output.parseValue ("ON", 2, parsed);
+
+    std::cout << "Field registry test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testSysExQueue()
+{
+    using namespace std::chrono_literals;
+    unsigned errors = 0;
+    const unsigned numMessages = 10000;
+
+    SysExQueue queue;
+    std::thread producer ([&] {
+        for (unsigned i = 0; i < numMessages; ++i)
+        {
+            uint8_t message[] = { 0xf0, uint8_t (i & 0x7f), uint8_t ((i >> 7) & 0x7f), 0xf7 };
+            while (!queue.push (message, sizeof (message)))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    // Messages are copied into the buffer, so it is not replaced by a slot's buffer
+    std::vector<uint8_t> message;
+    message.reserve (256);
+    const uint8_t * buffer = message.data();
+    for (unsigned i = 0; i < numMessages; ++i)
+    {
+        if (!queue.pop (message, SysExQueue::Clock::now() + 1000ms))
+        {
+            ++errors;
+            break;
+        }
+        errors += message.size() != 4 || message[1] != (i & 0x7f) || message[2] != ((i >> 7) & 0x7f);
+    }
+    producer.join();
+    errors += message.data() != buffer;
+
+    auto start = SysExQueue::Clock::now();
+    errors += queue.pop (message, start + 20ms);
+    errors += SysExQueue::Clock::now() - start < 20ms;
+
+    std::cout << "SysEx queue test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testSysExFramer()
+{
+    unsigned errors = 0;
+    std::vector<std::vector<uint8_t>> messages;
+    SysExFramer framer (8);
+    auto deliver = [&] (const uint8_t * data, size_t size) { messages.emplace_back (data, data + size); };
+
+    // Clock and note bytes around and inside a SysEx, split over two reads
+    std::vector<uint8_t> stream { 0x90, 0x40, 0x7f, 0xf0, 0x41, 0xf8, 0x10, 0x20, 0xfe, 0x30 };
+    framer.feed (stream.data(), stream.size(), deliver);
+    errors += !messages.empty();
+    stream = { 0x40, 0xf7, 0x80, 0x40 };
+    framer.feed (stream.data(), stream.size(), deliver);
+    errors += messages.size() != 1 || messages[0] != std::vector<uint8_t> { 0xf0, 0x41, 0x10, 0x20, 0x30, 0x40, 0xf7 };
+
+    // Interrupted by a status byte, restarted by F0, too long
+    stream = { 0xf0, 0x01, 0x90, 0xf7, 0xf0, 0x02, 0xf0, 0x03, 0xf7, 0xf0, 1, 2, 3, 4, 5, 6, 7, 0xf7 };
+    framer.feed (stream.data(), stream.size(), deliver);
+    errors += messages.size() != 2 || messages[1] != std::vector<uint8_t> { 0xf0, 0x03, 0xf7 };
+    errors += framer.dropped() != 3;
+
+    std::cout << "SysEx framer test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testTransport()
+{
+    using namespace std::chrono_literals;
+    unsigned errors = 0;
+    std::string session = "test_session.txt";
+    std::vector<uint8_t> message { 0xf0, 0x7e, 0x7f, 0x06, 0x01, 0xf7 };
+    std::vector<uint8_t> received;
+
+    // Loopback without a responder echoes, after the latency
+    {
+        SysExQueue queue;
+        std::unique_ptr<MidiTransport> loopback (new LoopbackTransport (nullptr, 5ms));
+        RecordingTransport recorder (std::move (loopback), session);
+        recorder.open ([&queue] (const uint8_t * data, size_t size) { queue.push (data, size); });
+
+        auto start = SysExQueue::Clock::now();
+        recorder.send (message);
+        errors += !queue.pop (received, start + 1000ms) || received != message;
+        errors += SysExQueue::Clock::now() - start < 5ms;
+    }
+
+    // Replay delivers the recorded answer when the recorded message is sent again
+    {
+        SysExQueue queue;
+        ReplayTransport replay (session);
+        replay.open ([&queue] (const uint8_t * data, size_t size) { queue.push (data, size); });
+        errors += queue.pop (received, SysExQueue::Clock::now() + 20ms);
+        replay.send (message);
+        errors += !queue.pop (received, SysExQueue::Clock::now() + 1000ms) || received != message;
+        errors += replay.mismatches() != 0;
+    }
+    std::remove (session.c_str());
+
+    std::cout << "Transport test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testEmulator()
+{
+    unsigned errors = 0;
+    Emulator emulator (3);
+    MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (emulator.responder())));
+
+    errors += midi.identity().size() < 8;
+
+    // Read
+    unsigned count = 0;
+    midi.retrievePatches (10, 20, [&] (unsigned patch, const std::vector<uint8_t> & data) {
+        errors += patch != 10 + count++ || data != emulator.patch (patch);
+    });
+    errors += count != 20;
+    auto system = midi.retrieveSystem();
+    errors += system.size() != Emulator::numSystemPages * PageFramer::dataSize;
+
+    // Names and loops come from the first page only, fields beyond it are not valid
+    unsigned pages = g_fields.at (FieldId::ID_PATCH_NAME_).pageMask() | g_fields.at (FieldId::ID_PATCH_LOOP_SW_LOOP_V).pageMask();
+    errors += pages != 1 || g_fields.at (FieldId::ID_PATCH_UNKNOWN_248).pageMask() != 2;
+    // Over DIN, the second page costs more than a request of its own
+    midi.setReadCosts ({std::chrono::microseconds (1000), std::chrono::microseconds (50000)});
+    unsigned requested = midi.readStats().pages;
+    count = 0;
+    midi.retrievePatches (40, 10, [&] (unsigned patch, const std::vector<uint8_t> & data) {
+        auto full = emulator.patch (patch);
+        errors += !std::equal (data.begin(), data.begin() + 125, full.begin()) || std::count (data.begin() + 125, data.end(), 0) != 125;
+
+        Patch partial, complete;
+        std::vector<uint8_t> d (data);
+        partial.setPartialData (d, pages);
+        complete.setData (full);
+        errors += partial.name() != complete.name() || partial.loops() != complete.loops();
+        errors += partial.fieldValid (FieldId::ID_PATCH_UNKNOWN_248) || !complete.fieldValid (FieldId::ID_PATCH_UNKNOWN_248);
+        ++count;
+    }, pages);
+    errors += count != 10 || midi.readStats().pages != requested + 10;
+
+    // Over USB, one request for all of them is cheaper, the pages in between are still passed on as zeros
+    midi.setReadCosts ({std::chrono::microseconds (1000), std::chrono::microseconds (20)});
+    requested = midi.readStats().requests;
+    midi.retrievePatches (40, 10, [&] (unsigned, const std::vector<uint8_t> & data) {
+        errors += std::count (data.begin() + 125, data.end(), 0) != 125;
+    }, pages);
+    errors += midi.readStats().requests != requested + 1;
+
+    // Scattered reads are all on the wire at once and handed out in any order, patch 3 is read once
+    unsigned requests = emulator.requests();
+    midi.prefetchPatches ({3, 417, 799, 3});
+    for (unsigned patch : {799u, 3u, 417u, 3u})
+    {
+        std::vector<uint8_t> data = midi.retrievePatch (patch);
+        errors += data != emulator.patch (patch);
+    }
+    errors += emulator.requests() != requests + 3;
+
+    // Nearby patches share a request
+    requests = emulator.requests();
+    midi.prefetchPatches ({7, 5});
+    errors += midi.retrievePatch (5) != emulator.patch (5) || midi.retrievePatch (7) != emulator.patch (7);
+    errors += emulator.requests() != requests + 1;
+
+    // Lost and corrupt pages are requested again
+    Emulator::Faults faults;
+    faults.dropRead = 0.02;
+    faults.corruptRead = 0.05;
+    emulator.setFaults (faults);
+    midi.setReadTimeout (std::chrono::milliseconds (50));
+    count = 0;
+    midi.retrievePatches (200, 100, [&] (unsigned patch, const std::vector<uint8_t> & data) {
+        errors += patch != 200 + count++ || data != emulator.patch (patch);
+    });
+    errors += count != 100 || midi.readStats().retries == 0 || midi.readStats().retriedPages == 0;
+    errors += midi.retrieveSystem() != system;
+
+    // Write and verify, with lost writes
+    faults = Emulator::Faults();
+    faults.dropWrite = 0.2;
+    emulator.setFaults (faults);
+    // With one write in five lost, some page is bound to be lost three times in a row
+    auto results = midi.restorePatches (100, 16, [] (unsigned patch) { return testData (250, patch); }, 4, 5);
+    unsigned retried = 0;
+    for (auto & result : results)
+    {
+        errors += !result.verified || emulator.patch (result.patch) != testData (250, result.patch);
+        retried += result.attempts > 1;
+    }
+    errors += retried == 0;
+
+    // Lost read backs are requested again instead of aborting the restore
+    faults = Emulator::Faults();
+    faults.dropRead = 0.2;
+    emulator.setFaults (faults);
+    unsigned retries = midi.readStats().retries;
+    results = midi.restorePatches (120, 16, [] (unsigned patch) { return testData (250, patch + 1); });
+    for (auto & result : results)
+    {
+        errors += !result.verified || emulator.patch (result.patch) != testData (250, result.patch + 1);
+    }
+    errors += midi.readStats().retries == retries;
+
+    // A patch whose read back stays lost is sent again, then reported as failed
+    faults.dropRead = 1;
+    emulator.setFaults (faults);
+    results = midi.restorePatches (140, 1, [] (unsigned patch) { return testData (250, patch + 1); }, 4, 2);
+    errors += results.size() != 1 || results[0].verified || results[0].attempts != 2;
+
+    // Pings during a restore let the gap shrink below its initial 2 ms again
+    emulator.setFaults (Emulator::Faults());
+    {
+        MIDI fresh (std::unique_ptr<MidiTransport> (new LoopbackTransport (emulator.responder())));
+        results = fresh.restorePatches (160, 16, [] (unsigned patch) { return testData (250, patch); });
+        errors += !results[15].verified || fresh.pacer().gap() >= std::chrono::milliseconds (2);
+    }
+
+    // Only the pages that differ from the device are written
+    emulator.setFaults (Emulator::Faults());
+    Patch renamed;
+    auto original = midi.retrievePatch (300);
+    renamed.setData (original);
+    renamed.setName ("Delta");
+    auto stats = midi.writeStats();
+    midi.sendPatch (300, renamed.data());
+    errors += midi.writeStats().pages != stats.pages + 1 || midi.writeStats().skipped != stats.skipped + 1;
+    errors += midi.retrievePatch (300) != renamed.data() || emulator.patch (300) != renamed.data();
+    midi.sendPatch (300, renamed.data());
+    errors += midi.writeStats().pages != stats.pages + 1;
+    midi.clearKnownPatches();
+    midi.sendPatch (300, renamed.data());
+    errors += midi.writeStats().pages != stats.pages + 3;
+
+    // Corrupted reads are detected
+    faults = Emulator::Faults();
+    faults.corruptRead = 1;
+    emulator.setFaults (faults);
+    try
+    {
+        midi.retrievePatches (0, 1, [] (unsigned, const std::vector<uint8_t> &) {});
+        ++errors;
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+
+    std::cout << "Emulator test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testPageCache()
+{
+    unsigned errors = 0;
+    const std::string filename = "selftest.cache";
+    std::remove (filename.c_str());
+    Emulator emulator (3);
+    auto connect = [&] (PageCache & cache, bool refresh) {
+        std::unique_ptr<MIDI> midi (new MIDI (std::unique_ptr<MidiTransport> (new LoopbackTransport (emulator.responder()))));
+        midi->setCache (&cache, refresh);
+        return midi;
+    };
+
+    // The first run reads from the device
+    {
+        PageCache cache (filename);
+        auto midi = connect (cache, false);
+        midi->retrievePatches (44, 2, [&] (unsigned patch, const std::vector<uint8_t> & data) { errors += data != emulator.patch (patch); });
+        errors += midi->readStats().cached != 0;
+        cache.save();
+    }
+
+    // The next one takes the pages from the cache, only the identity is requested
+    unsigned requests = emulator.requests();
+    auto data = testData (250, 44);
+    {
+        PageCache cache (filename);
+        auto midi = connect (cache, false);
+        errors += midi->retrievePatch (44) != emulator.patch (44) || midi->readStats().cached != 2 || emulator.requests() != requests;
+
+        // A write flags the device in the file before it goes out, an interrupted run leaves no outdated pages
+        midi->sendPatch (44, data);
+        midi->retrieveSystem();
+        {
+            PageCache interrupted (filename);
+            auto other = connect (interrupted, false);
+            errors += other->retrievePatch (45) != emulator.patch (45) || other->readStats().cached != 0;
+        }
+        cache.save();
+    }
+
+    // Written pages are read from the device again
+    {
+        PageCache cache (filename);
+        auto midi = connect (cache, false);
+        errors += midi->retrievePatch (45) != emulator.patch (45) || midi->readStats().cached != 2;
+        errors += midi->retrievePatch (44) != data || midi->readStats().cached != 2;
+    }
+
+    // Pages served from the cache may be outdated, so writes matching them still go out
+    auto cachedPatch = emulator.patch (45);
+    emulator.setPatch (45, testData (250, 45));
+    {
+        PageCache cache (filename);
+        auto midi = connect (cache, false);
+        errors += midi->retrievePatch (45) != cachedPatch || midi->readStats().cached != 2;
+        midi->sendPatch (45, cachedPatch);
+        midi->retrieveSystem();
+        errors += midi->writeStats().pages != 2 || emulator.patch (45) != cachedPatch;
+    }
+
+    // Refreshing bypasses the cache
+    {
+        PageCache cache (filename);
+        auto midi = connect (cache, true);
+        requests = emulator.requests();
+        errors += midi->retrievePatch (45) != emulator.patch (45) || midi->readStats().cached != 0 || emulator.requests() != requests + 1;
+    }
+    std::remove (filename.c_str());
+
+    std::cout << "Page cache test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
 }
 
-void testStruct()
+void testProgramPlan()
 {
-    std::vector<unsigned> testMap (8 * 250);
-    std::map<Field::Type, unsigned> numBits;
-    numBits[Field::Globals] = 0;
-    numBits[Field::Patch] = 0;
-    for (auto it = g_fields.begin(); it != g_fields.end(); ++it)
+    unsigned errors = 0;
+
+    // A template selected again and again, copies and a patch viewed after writing it
+    const char * argv[] = { "es8cli", "select", "700", "name", "Clean", "store", "1", "display",
+        "select", "700", "name", "Fuzz", "loops", "24V", "store", "2", "display",
+        "copy", "1", "3", "view", "2", "select", "5", "store", "6", "view", "6", "copy", "300", "301", "view", "700" };
+    CmdLineParameters config;
+    parseCommandLine (config, sizeof (argv) / sizeof (argv[0]), const_cast<char **> (argv));
+
+    // The same results as running the commands one by one, with fewer requests
+    Emulator planned (5), oneByOne (5);
+    std::ostringstream plannedOut, oneByOneOut;
+    std::streambuf * out = std::cout.rdbuf (plannedOut.rdbuf());
     {
-       for (auto i = 0; i < it->second.numFields(); ++i)
-       {
-           //std::cout << it->id() << " " << i << std::endl;
-           numBits[it->second.type()] += it->second.bitLength();
-           if (it->second.type() == Field::Patch)
-           {
-               for (auto j = 0; j < it->second.bitLength(); ++j)
-               {
-                   testMap[it->second.bitOffset(i) + j]++;
-               }
-           }
-       }
+        MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (planned.responder())));
+        runCommands (config.commands, &midi);
     }
+    std::cout.rdbuf (oneByOneOut.rdbuf());
+    {
+        MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (oneByOne.responder())));
+        std::vector<uint8_t> data;
+        size_t count = 1;
+        for (auto & cmd : config.commands)
+        {
+            std::cout << count++ << ": ";
+            executeCommand (cmd, data, &midi);
+            std::cout << std::endl;
+        }
+        // The device has taken all writes once it answers
+        midi.retrieveSystem();
+    }
+    std::cout.rdbuf (out);
 
-    for (auto i = 0; i < 250; ++i)
+    errors += plannedOut.str() != oneByOneOut.str();
+    for (unsigned patch = 0; patch < Emulator::numPatches; ++patch)
+    {
+        errors += planned.patch (patch) != oneByOne.patch (patch);
+    }
+    errors += planned.requests() >= oneByOne.requests();
+
+    // File names after a restore are not planned, a bad restore fails only when it runs
+    const char * badArgv[] = { "es8cli", "view", "3", "restore", "2", "1", "backup.es8", "select", "backup.es8" };
+    CmdLineParameters badConfig;
+    parseCommandLine (badConfig, sizeof (badArgv) / sizeof (badArgv[0]), const_cast<char **> (badArgv));
+    std::ostringstream badOut;
+    std::string error;
+    std::cout.rdbuf (badOut.rdbuf());
+    try
+    {
+        MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (planned.responder())));
+        runCommands (badConfig.commands, &midi);
+    }
+    catch (const std::runtime_error & e)
     {
-        std::cout << i << ": ";
-        for (auto j = 0; j < 8; ++j)
+        error = e.what();
+    }
+    std::cout.rdbuf (out);
+    errors += error != "Invalid patch range.";
+    errors += badOut.str().find ("=== Restore") == std::string::npos;
+
+    std::cout << "Program plan test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testBackup()
+{
+    unsigned errors = 0;
+    Emulator emulator (4);
+    MIDI midi (std::unique_ptr<MidiTransport> (new LoopbackTransport (emulator.responder())));
+    auto backup = [&] (const char * dir) {
+        const char * argv[] = { "es8cli", "backup", "3", "4", dir };
+        CmdLineParameters config;
+        parseCommandLine (config, sizeof (argv) / sizeof (argv[0]), const_cast<char **> (argv));
+        std::vector<uint8_t> data;
+        try
+        {
+            executeCommand (config.commands.front(), data, &midi);
+            return true;
+        }
+        catch (const std::runtime_error &)
         {
-            if (testMap[i*8+j] != 1)
+            return false;
+        }
+    };
+
+    // A directory that cannot be created, and a file in the way of the patch files
+    std::streambuf * out = std::cout.rdbuf (nullptr);
+    errors += backup ("selftest_missing/backup");
+    std::ofstream ("selftest_file") << "x";
+    errors += backup ("selftest_file");
+
+    // Every patch saved
+    errors += !backup ("selftest_backup");
+    std::cout.rdbuf (out);
+    std::cout.clear();
+    for (unsigned patch = 3; patch <= 4; ++patch)
+    {
+        std::string filename = "selftest_backup/00" + std::to_string (patch) + ".es8";
+        Patch saved;
+        saved.load (filename);
+        errors += saved.data() != emulator.patch (patch);
+        std::remove (filename.c_str());
+    }
+    errors += std::ifstream ("selftest_backup/progress").good();
+
+    // Backups read from the device, not from a cache of older contents
+    const std::string cacheName = "selftest.cache";
+    {
+        PageCache cache (cacheName);
+        midi.setCache (&cache);
+        midi.retrievePatch (3);
+        midi.setCache (nullptr);
+        cache.save();
+    }
+    emulator.setPatch (3, testData (250, 3));
+    {
+        PageCache cache (cacheName);
+        midi.clearKnownPatches();
+        midi.setCache (&cache);
+        out = std::cout.rdbuf (nullptr);
+        errors += !backup ("selftest_backup");
+        std::cout.rdbuf (out);
+        std::cout.clear();
+        midi.setCache (nullptr);
+    }
+    Patch saved;
+    saved.load ("selftest_backup/003.es8");
+    errors += saved.data() != testData (250, 3);
+    std::remove ("selftest_backup/003.es8");
+    std::remove ("selftest_backup/004.es8");
+    std::remove (cacheName.c_str());
+    std::remove ("selftest_backup");
+    std::remove ("selftest_file");
+
+    std::cout << "Backup test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testWritePacer()
+{
+    using namespace std::chrono_literals;
+    unsigned errors = 0;
+
+    // 100 pages/s of 155 bytes, no device gap
+    WritePacer pacer (15500, 0ms);
+    auto start = WritePacer::Clock::now();
+    for (unsigned i = 0; i < 6; ++i)
+    {
+        pacer.wait (155);
+    }
+    errors += WritePacer::Clock::now() - start < 50ms;
+    errors += pacer.pages() != 6;
+    errors += pacer.pagesPerSecond() < 95 || pacer.pagesPerSecond() > 105;
+
+    pacer.setIdleRoundTrip (1ms);
+    pacer.adapt (10ms);
+    auto grown = pacer.gap();
+    errors += grown <= 0ms;
+    pacer.adapt (1ms);
+    errors += pacer.gap() >= grown;
+
+    std::cout << "Write pacer test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+/** Cost of a plan from planPageRanges(). */
+double testPlanCost (const std::vector<PageRange> & ranges, double requestCost, double pageCost)
+{
+    double cost = 0;
+    for (auto & range : ranges)
+    {
+        cost += requestCost + pageCost * range.count;
+    }
+    return cost;
+}
+
+void testReadPlanner()
+{
+    unsigned errors = 0;
+
+    errors += !planPageRanges ({}, 1000, 20, 128).empty();
+
+    // Patches 1-8, 100, 101 and 640-647: the gaps cost more than a request
+    std::vector<unsigned> pages;
+    for (unsigned patch : {1, 2, 3, 4, 5, 6, 7, 8, 100, 101, 640, 641, 642, 643, 644, 645, 646, 647})
+    {
+        pages.push_back (14 + 2 * patch);
+        pages.push_back (15 + 2 * patch);
+    }
+    auto ranges = planPageRanges (pages, 1000, 20, 128);
+    errors += ranges.size() != 3 || ranges[0].first != 16 || ranges[0].count != 16 || ranges[1].first != 214 || ranges[1].count != 4 || ranges[2].first != 1294 || ranges[2].count != 16;
+
+    // A gap is fetched along if it is cheaper than a request, duplicates are fetched once
+    ranges = planPageRanges ({12, 10, 12}, 100, 20, 128);
+    errors += ranges.size() != 1 || ranges[0].first != 10 || ranges[0].count != 3;
+    ranges = planPageRanges ({12, 10, 12}, 100, 200, 128);
+    errors += ranges.size() != 2 || ranges[0].first != 10 || ranges[0].count != 1 || ranges[1].first != 12 || ranges[1].count != 1;
+
+    // Long runs are split
+    pages.clear();
+    for (unsigned page = 0; page < 200; ++page)
+    {
+        pages.push_back (page);
+    }
+    ranges = planPageRanges (pages, 1000, 20, 128);
+    errors += ranges.size() != 2 || ranges[0].count + ranges[1].count != 200 || ranges[0].count > 128 || ranges[1].count > 128;
+
+    // As cheap as the best of all ways to split random pages into requests
+    std::mt19937 gen (1);
+    for (unsigned round = 0; round < 200; ++round)
+    {
+        std::set<unsigned> set;
+        while (set.size() < 1 + gen() % 8)
+        {
+            set.insert (gen() % 40);
+        }
+        std::vector<unsigned> sorted (set.begin(), set.end());
+        double requestCost = gen() % 100;
+        double pageCost = 1 + gen() % 20;
+        unsigned maxCount = 1 + gen() % 20;
+
+        double best = 1e30;
+        for (unsigned cuts = 0; cuts < (1u << (sorted.size() - 1)); ++cuts)
+        {
+            double cost = 0;
+            unsigned start = 0;
+            for (unsigned i = 0; i < sorted.size(); ++i)
             {
-                std::cerr << " Corrupted value map" << std::endl;
+                if (i + 1 == sorted.size() || (cuts & (1u << i)))
+                {
+                    unsigned count = sorted[i] - sorted[start] + 1;
+                    cost += count > maxCount ? 1e30 : requestCost + pageCost * count;
+                    start = i + 1;
+                }
             }
-            std::cout <<  unsigned(testMap[i*8+j]);
+            best = std::min (best, cost);
+        }
+
+        ranges = planPageRanges (sorted, requestCost, pageCost, maxCount);
+        size_t covered = 0;
+        for (auto & range : ranges)
+        {
+            errors += range.count > maxCount;
+            covered += std::count_if (sorted.begin(), sorted.end(), [&] (unsigned p) { return p - range.first < range.count; });
         }
-        std::cout << std::endl;
+        errors += covered != sorted.size() || testPlanCost (ranges, requestCost, pageCost) > best + 1e-9;
     }
+
+    std::cout << "Read planner test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testUnscramblePage()
+{
+    unsigned errors = 0;
+    auto data = testData (250, 7);
+    auto scrambled = MIDI::scrambleData (data);
+
+    std::vector<uint8_t> result;
+    for (size_t page = 0; page < 2; ++page)
+    {
+        WritePageMessage wpm (14 + page, std::vector<uint8_t> (&scrambled[page*155], &scrambled[(page+1)*155]));
+        auto message = wpm.getMessageData();
+        errors += !MIDI::unscramblePage (message.data(), result);
+
+        message[40] ^= 0x01;
+        std::vector<uint8_t> ignored;
+        errors += MIDI::unscramblePage (message.data(), ignored) || !ignored.empty();
+    }
+    errors += result != data;
+
+    std::cout << "Unscramble page test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
+}
+
+void testPageFramer()
+{
+    unsigned errors = 0;
+    auto data = testData (250, 9);
+    auto scrambled = MIDI::scrambleData (data);
+    std::vector<uint8_t> stream;
+    for (size_t page = 0; page < 2; ++page)
+    {
+        WritePageMessage wpm (20 + page, std::vector<uint8_t> (&scrambled[page*155], &scrambled[(page+1)*155]));
+        auto message = wpm.getMessageData();
+        stream.insert (stream.end(), message.begin(), message.end());
+    }
+
+    std::vector<uint8_t> result;
+    unsigned invalid = 0;
+    PageFramer framer;
+    unsigned route = framer.route (20, 2, [&] (unsigned page, const uint8_t * d, bool valid) {
+        errors += page != 20 + result.size() / 125;
+        invalid += !valid;
+        result.insert (result.end(), d, d + 125);
+    });
+
+    // Any split of the stream gives the same pages
+    for (size_t split = 0; split <= stream.size(); split += 7)
+    {
+        result.clear();
+        framer.feed (stream.data(), split);
+        framer.feed (stream.data() + split, stream.size() - split);
+        errors += result != data;
+    }
+    errors += invalid != 0 || framer.rejected() != 0;
+
+    // Bad checksum is flagged, wrong header, truncated and unrouted pages are rejected
+    auto bad = stream;
+    bad[40] ^= 0x01;
+    result.clear();
+    framer.feed (bad.data(), 155);
+    errors += invalid != 1 || result.size() != 125;
+
+    bad = stream;
+    bad[3] = 0x01;
+    bad[155 + 100] = 0xf7;
+    framer.feed (bad.data(), bad.size());
+    framer.unroute (route);
+    framer.feed (stream.data(), stream.size());
+    errors += framer.rejected() != 4 || result.size() != 125;
+
+    std::cout << "Page framer test: " << (errors == 0 ? "OK" : "FAIL") << std::endl;
 }
 
 void testScramble(std::vector<uint8_t> d)
 {
     auto u = MIDI::unscrambleData(d);
     auto re = MIDI::scrambleData(u);
-    for (auto block = 0; block < d.size()/155; ++block)
+    for (size_t block = 0; block < d.size()/155; ++block)
     {
         for (size_t i = 10; i < 155-2; ++i)
         {
@@ -95,7 +903,7 @@ void testScramble(std::vector<uint8_t> d)
     }
     std::cout << std::endl;
     auto reu = MIDI::unscrambleData(re);
-    for (auto block = 0; block < u.size()/125; ++block)
+    for (size_t block = 0; block < u.size()/125; ++block)
     {
         for (size_t i = 0; i < 125; ++i)
         {
@@ -120,7 +928,7 @@ void testScrambleRev(std::vector<uint8_t> d)
     m1.insert (m1.end(), m2.begin(), m2.end());
 
     auto re = MIDI::unscrambleData(m1);
-    for (auto block = 0; block < d.size()/125; ++block)
+    for (size_t block = 0; block < d.size()/125; ++block)
     {
         std::cout <<std::endl << "block " << block << std::endl;
         for (size_t i = 0; i < 125; ++i)
@@ -140,7 +948,7 @@ void testScrambleRev(std::vector<uint8_t> d)
 
     m3.insert (m3.end(), m4.begin(), m4.end());
 
-    for (auto block = 0; block < u.size()/155; ++block)
+    for (size_t block = 0; block < u.size()/155; ++block)
     {
         std::cout <<std::endl << "block " << block << std::endl;
         for (size_t i = 0; i < 155; ++i)
@@ -0,0 +1,81 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#include <thread>
+#include <algorithm>
+
+#include "writepacer.hpp"
+
+using namespace std::chrono_literals;
+
+/** Smallest gap the pacer grows from once the device falls behind. */
+static const WritePacer::Clock::duration minGrowGap = 250us;
+/** Largest gap, the device is hardly falling behind further than this. */
+static const WritePacer::Clock::duration maxGap = 100ms;
+
+WritePacer::WritePacer (unsigned bytesPerSecond, Clock::duration gap) : m_bytesPerSecond (bytesPerSecond), m_gap (gap), m_idleRtt (0), m_pages (0)
+{
+}
+
+void WritePacer::wait (size_t bytes)
+{
+    auto now = Clock::now();
+    if (m_pages == 0)
+    {
+        m_start = now;
+        m_next = now;
+    }
+
+    if (m_next > now)
+    {
+        std::this_thread::sleep_until (m_next);
+        now = m_next;
+    }
+
+    // The link is busy for the transmission time, the device for the gap.
+    Clock::duration transmission (0);
+    if (m_bytesPerSecond > 0)
+    {
+        transmission = std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (double (bytes) / m_bytesPerSecond));
+    }
+    m_next = now + transmission + m_gap;
+    ++m_pages;
+}
+
+void WritePacer::setIdleRoundTrip (Clock::duration rtt)
+{
+    m_idleRtt = rtt;
+}
+
+void WritePacer::adapt (Clock::duration rtt)
+{
+    if (rtt > 2 * m_idleRtt + 1ms)
+    {
+        slowDown();
+    }
+    else
+    {
+        m_gap = m_gap * 3 / 4;
+    }
+}
+
+void WritePacer::slowDown ()
+{
+    m_gap = std::min (std::max (2 * m_gap, minGrowGap), maxGap);
+}
+
+WritePacer::Clock::duration WritePacer::gap () const
+{
+    return m_gap;
+}
+
+unsigned WritePacer::pages () const
+{
+    return m_pages;
+}
+
+double WritePacer::pagesPerSecond () const
+{
+    double seconds = std::chrono::duration<double> (m_next - m_start).count();
+    return seconds > 0 ? m_pages / seconds : 0;
+}
@@ -0,0 +1,64 @@
+/* Copyright (c) 2021 Martin Profittlich. All rights reserved. */
+/* The file LICENSE contains more information about licensing. */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+/**
+ * Schedule page writes to the ES-8.
+ *
+ * Two limits apply: the byte budget of the link (e.g. 3125 bytes/s on a
+ * 31250 baud DIN connection, none on USB) and a gap per page that gives
+ * the device time to store it. The gap adapts to the device: a slow
+ * identity ping means pages are piling up and the gap grows, a fast ping
+ * lets it shrink again.
+ */
+class WritePacer
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * Constructor
+         *
+         * @param bytesPerSecond Byte budget of the link, 0 for no limit.
+         * @param gap Initial gap after each page.
+         */
+        WritePacer (unsigned bytesPerSecond = 0, Clock::duration gap = std::chrono::milliseconds (2));
+
+        /** Wait until a message of the given size may be sent and account for it. */
+        void wait (size_t bytes);
+
+        /**
+         * Set the ping round trip of an idle device, as a reference for adapt().
+         */
+        void setIdleRoundTrip (Clock::duration rtt);
+
+        /**
+         * Adjust the gap to the round trip of an identity ping sent after
+         * the pages written so far.
+         */
+        void adapt (Clock::duration rtt);
+
+        /** Grow the gap, e.g. after the device lost a page. */
+        void slowDown ();
+
+        /** Current gap after each page. */
+        Clock::duration gap () const;
+
+        /** Number of messages sent since construction. */
+        unsigned pages () const;
+
+        /** Achieved pages per second, from the first page until the link is free again. */
+        double pagesPerSecond () const;
+
+    private:
+        unsigned m_bytesPerSecond;
+        Clock::duration m_gap;
+        Clock::duration m_idleRtt;
+        Clock::time_point m_next;
+        Clock::time_point m_start;
+        unsigned m_pages;
+};